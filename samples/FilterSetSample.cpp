@@ -22,7 +22,12 @@
 #include "../config.h"
 
 #include "GaborSet.hpp"
+#include "GaborSetCache.hpp"
 #include "GaborFilter.hpp"
+#include "GaborFilteringPlan.hpp"
+#include "FixedGaborSet.hpp"
+#include "KernelBank.hpp"
+#include "FilteringHelpers.hpp"
 #include "DebugHelpers.hpp"
 #include "opencv2/opencv.hpp"
 
@@ -46,4 +51,132 @@ void gaborFilterSetTest()
     duration = static_cast<double>(cv::getTickCount()) - duration;
 	duration /= cv::getTickFrequency();
 	cout << "Elapsed time: " << duration << " seconds." << endl;
+
+	duration = static_cast<double>(cv::getTickCount());
+	GaborSet<double> filterSetFFT(5, 8, 120, M_PI/2, 2*M_PI, true,
+			GABOR_FREQUENCY_DOMAIN);
+    duration = static_cast<double>(cv::getTickCount()) - duration;
+	duration /= cv::getTickFrequency();
+	cout << "Elapsed time (frequency domain): " << duration << " seconds."
+			<< endl;
+
+	// Fine scales only need a fraction of the nominal support
+	duration = static_cast<double>(cv::getTickCount());
+	GaborSet<double> adaptiveSet(5, 8, 120, M_PI/2, 2*M_PI, true,
+			GABOR_SPATIAL_DOMAIN, 1e-3);
+    duration = static_cast<double>(cv::getTickCount()) - duration;
+	duration /= cv::getTickFrequency();
+	cout << "Elapsed time (adaptive support): " << duration << " seconds."
+			<< endl;
+	for(int i=0; i<adaptiveSet.getScales(); i++)
+	{
+		cout << "Scale " << i << " support: "
+				<< adaptiveSet.getGaborSet()[i*adaptiveSet.getOrientations()]
+				.getFilterSizeX() << endl;
+	}
+
+	// The second request for the same parameters is served from the cache
+	for(int i=0; i<2; i++)
+	{
+		duration = static_cast<double>(cv::getTickCount());
+		GaborSet<double> cachedSet = GaborSetCache::get<double>(5, 8, 120,
+				M_PI/2, 2*M_PI, true);
+		duration = static_cast<double>(cv::getTickCount()) - duration;
+		duration /= cv::getTickFrequency();
+		cout << "Elapsed time (cache request " << i+1 << "): " << duration
+				<< " seconds." << endl;
+	}
+
+	// Precomputed plans can be saved once and mapped by every worker
+	GaborFilteringPlan<double> plan(filterSet, Size(120, 120));
+	plan.save("gaborPlan.bin");
+
+	duration = static_cast<double>(cv::getTickCount());
+	GaborFilteringPlan<double> loadedPlan =
+			GaborFilteringPlan<double>::load("gaborPlan.bin");
+    duration = static_cast<double>(cv::getTickCount()) - duration;
+	duration /= cv::getTickFrequency();
+	cout << "Elapsed time (plan load): " << duration << " seconds." << endl;
+
+	// Custom kernels use the same plans as Gabor sets, here a bank of
+	// differences of Gaussians
+	KernelBank<double> dogBank;
+	for(int i=1; i<=4; i++)
+	{
+		Mat_<double> narrow = getGaussianKernel(31, i, CV_64F);
+		Mat_<double> wide = getGaussianKernel(31, 2*i, CV_64F);
+		dogBank.add(Mat_<double>(narrow*narrow.t() - wide*wide.t()));
+	}
+
+	Mat_<double> image(120, 120);
+	randu(image, Scalar::all(0), Scalar::all(1));
+	Mat_<double> dogFeatures;
+	duration = static_cast<double>(cv::getTickCount());
+	FilteringHelpers::imageApplyGaborSet(image, dogBank, dogFeatures, true,
+			false);
+    duration = static_cast<double>(cv::getTickCount()) - duration;
+	duration /= cv::getTickFrequency();
+	cout << "Elapsed time (custom bank): " << duration << " seconds." << endl;
+
+	// The whole pipeline also runs in single precision
+	GaborSet<float> floatSet(5, 8, 120, M_PI/2, 2*M_PI, true);
+	Mat_<float> floatImage = image;
+	Mat_<float> floatFeatures;
+	duration = static_cast<double>(cv::getTickCount());
+	FilteringHelpers::imageApplyGaborSet(floatImage, floatSet, floatFeatures,
+			true, false);
+    duration = static_cast<double>(cv::getTickCount()) - duration;
+	duration /= cv::getTickFrequency();
+	cout << "Elapsed time (float filtering): " << duration << " seconds."
+			<< endl;
+
+	// Tiles of an image larger than FILTERING_TILE_SIZE give the features
+	// of the whole image, also with the two pass normalization
+	GaborSet<double> tileSet(5, 8, 31, M_PI/2, 2*M_PI, true);
+	Mat_<double> largeImage(300, 300);
+	randu(largeImage, Scalar::all(0), Scalar::all(1));
+	for(int i=0; i<2; i++)
+	{
+		bool needZMUNorm = (i == 1);
+		Mat_<double> wholeFeatures;
+		Mat_<double> tiledFeatures;
+		FilteringHelpers::imageApplyGaborSet(largeImage, tileSet,
+				wholeFeatures, needZMUNorm, false);
+		duration = static_cast<double>(cv::getTickCount());
+		FilteringHelpers::imageApplyGaborSetTiled(largeImage, tileSet,
+				tiledFeatures, needZMUNorm, false);
+		duration = static_cast<double>(cv::getTickCount()) - duration;
+		duration /= cv::getTickFrequency();
+		cout << "Elapsed time (tiled" << (needZMUNorm ? ", ZMU" : "")
+				<< "): " << duration << " seconds." << endl;
+		cout << "Maximum tiled difference" << (needZMUNorm ? " (ZMU)" : "")
+				<< ": " << norm(wholeFeatures, tiledFeatures, NORM_INF)
+				<< endl;
+	}
+
+	// Sets of a fixed geometry give the features of the default FFT plan
+	// and FOLD downsampling, here with a step of 2
+	typedef FixedGaborSet<double, 3, 4, 64, 64, 2, 31, 31> FixedSet;
+	GaborSet<double> variableSet(3, 4, 31, 31, M_PI/2, 2*M_PI, true);
+	Mat_<double> fixedImage(64, 64);
+	randu(fixedImage, Scalar::all(0), Scalar::all(1));
+	for(int i=0; i<2; i++)
+	{
+		bool needZMUNorm = (i == 1);
+		FixedSet* fixedSet = new FixedSet(M_PI/2, 2*M_PI, needZMUNorm);
+		Mat_<double> variableFeatures;
+		Mat_<double> fixedFeatures;
+		FilteringHelpers::imageApplyGaborSet(fixedImage, variableSet,
+				variableFeatures, needZMUNorm, true, 0.5);
+		duration = static_cast<double>(cv::getTickCount());
+		fixedSet->apply(fixedImage, fixedFeatures);
+		duration = static_cast<double>(cv::getTickCount()) - duration;
+		duration /= cv::getTickFrequency();
+		cout << "Elapsed time (fixed set" << (needZMUNorm ? ", ZMU" : "")
+				<< "): " << duration << " seconds." << endl;
+		cout << "Maximum fixed set difference"
+				<< (needZMUNorm ? " (ZMU)" : "") << ": "
+				<< norm(variableFeatures, fixedFeatures, NORM_INF) << endl;
+		delete fixedSet;
+	}
 }
@@ -0,0 +1,982 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#include "../config.h"
+#include "FFTBackend.hpp"
+#include "opencv2/core/internal.hpp"
+#include <fstream>
+
+#ifdef HAVE_FFTW3
+#include <fftw3.h>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+#endif
+
+namespace fex
+{
+using namespace cv;
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                             OpenCVFFTBackend                             ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+class OpenCVFFTBackend : public FFTBackend
+{
+public:
+
+    int getType() const;
+    void dft(const Mat& src, Mat& dst, int flags, int nonzeroRows);
+};
+
+int OpenCVFFTBackend::getType() const
+{
+    return (FFT_BACKEND_OPENCV);
+}
+
+void OpenCVFFTBackend::dft(const Mat& src, Mat& dst, int flags,
+        int nonzeroRows)
+{
+    cv::dft(src, dst, flags, nonzeroRows);
+}
+
+#ifdef HAVE_FFTW3
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                               FFTWTraits                                 ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Double and single precision FFTW entry points
+ */
+template<typename _Tp> struct FFTWTraits;
+
+template<> struct FFTWTraits<double>
+{
+    typedef fftw_plan Plan;
+    typedef fftw_complex Complex;
+
+    static Plan planComplex(const int* size, int count, Complex* in,
+            Complex* out, int sign, unsigned flags)
+    {
+        int dist = size[0]*size[1];
+        return (fftw_plan_many_dft(2, size, count, in, 0, 1, dist, out, 0, 1,
+                dist, sign, flags));
+    }
+    static Plan planForwardReal(const int* size, int count, double* in,
+            Complex* out, unsigned flags)
+    {
+        return (fftw_plan_many_dft_r2c(2, size, count, in, 0, 1,
+                size[0]*size[1], out, 0, 1, size[0]*(size[1]/2 + 1), flags));
+    }
+    static Plan planInverseReal(const int* size, int count, Complex* in,
+            double* out, unsigned flags)
+    {
+        return (fftw_plan_many_dft_c2r(2, size, count, in, 0, 1,
+                size[0]*(size[1]/2 + 1), out, 0, 1, size[0]*size[1], flags));
+    }
+    static void executeComplex(Plan plan, Complex* in, Complex* out)
+    {
+        fftw_execute_dft(plan, in, out);
+    }
+    static void executeForwardReal(Plan plan, double* in, Complex* out)
+    {
+        fftw_execute_dft_r2c(plan, in, out);
+    }
+    static void executeInverseReal(Plan plan, Complex* in, double* out)
+    {
+        fftw_execute_dft_c2r(plan, in, out);
+    }
+    static void destroy(Plan plan)
+    {
+        fftw_destroy_plan(plan);
+    }
+    static void* allocate(size_t size)
+    {
+        return (fftw_malloc(size));
+    }
+    static void release(void* data)
+    {
+        fftw_free(data);
+    }
+    static bool isAligned(void* data)
+    {
+        return (fftw_alignment_of((double*)data) == 0);
+    }
+    static char* exportWisdom()
+    {
+        return (fftw_export_wisdom_to_string());
+    }
+    static bool importWisdom(const char* wisdom)
+    {
+        return (fftw_import_wisdom_from_string(wisdom) != 0);
+    }
+};
+
+template<> struct FFTWTraits<float>
+{
+    typedef fftwf_plan Plan;
+    typedef fftwf_complex Complex;
+
+    static Plan planComplex(const int* size, int count, Complex* in,
+            Complex* out, int sign, unsigned flags)
+    {
+        int dist = size[0]*size[1];
+        return (fftwf_plan_many_dft(2, size, count, in, 0, 1, dist, out, 0, 1,
+                dist, sign, flags));
+    }
+    static Plan planForwardReal(const int* size, int count, float* in,
+            Complex* out, unsigned flags)
+    {
+        return (fftwf_plan_many_dft_r2c(2, size, count, in, 0, 1,
+                size[0]*size[1], out, 0, 1, size[0]*(size[1]/2 + 1), flags));
+    }
+    static Plan planInverseReal(const int* size, int count, Complex* in,
+            float* out, unsigned flags)
+    {
+        return (fftwf_plan_many_dft_c2r(2, size, count, in, 0, 1,
+                size[0]*(size[1]/2 + 1), out, 0, 1, size[0]*size[1], flags));
+    }
+    static void executeComplex(Plan plan, Complex* in, Complex* out)
+    {
+        fftwf_execute_dft(plan, in, out);
+    }
+    static void executeForwardReal(Plan plan, float* in, Complex* out)
+    {
+        fftwf_execute_dft_r2c(plan, in, out);
+    }
+    static void executeInverseReal(Plan plan, Complex* in, float* out)
+    {
+        fftwf_execute_dft_c2r(plan, in, out);
+    }
+    static void destroy(Plan plan)
+    {
+        fftwf_destroy_plan(plan);
+    }
+    static void* allocate(size_t size)
+    {
+        return (fftwf_malloc(size));
+    }
+    static void release(void* data)
+    {
+        fftwf_free(data);
+    }
+    static bool isAligned(void* data)
+    {
+        return (fftwf_alignment_of((float*)data) == 0);
+    }
+    static char* exportWisdom()
+    {
+        return (fftwf_export_wisdom_to_string());
+    }
+    static bool importWisdom(const char* wisdom)
+    {
+        return (fftwf_import_wisdom_from_string(wisdom) != 0);
+    }
+};
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                              FFTWPlanCache                               ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+enum
+{
+    FFTW_KIND_FORWARD = 0,
+    FFTW_KIND_INVERSE = 1,
+    FFTW_KIND_FORWARD_REAL = 2,
+    FFTW_KIND_INVERSE_REAL = 3
+};
+
+// Transforms per FFTW call in batches, the last call taking the remainder
+const int FFTW_BATCH_SIZE = 8;
+
+/*
+ * FFTW buffer, aligned as the buffers plans are built on
+ */
+template<typename _Tp> class FFTWBuffer
+{
+public:
+
+    FFTWBuffer() :
+        mData(0), mSize(0)
+    {
+    }
+    FFTWBuffer(size_t size) :
+        mData(0), mSize(0)
+    {
+        reserve(size);
+    }
+    ~FFTWBuffer()
+    {
+        FFTWTraits<_Tp>::release(mData);
+    }
+
+    /*
+     * Grows the buffer to at least size bytes, dropping its content if it
+     * has to be reallocated
+     */
+    void reserve(size_t size)
+    {
+        if(size <= mSize)
+        {
+            return;
+        }
+        FFTWTraits<_Tp>::release(mData);
+        mSize = 0;
+        mData = FFTWTraits<_Tp>::allocate(size);
+        if(mData == 0)
+        {
+            CV_Error(CV_StsNoMem, "Could not allocate an FFTW buffer");
+        }
+        mSize = size;
+    }
+
+    void* getData() const
+    {
+        return (mData);
+    }
+
+private:
+
+    void* mData;
+    size_t mSize;
+
+    FFTWBuffer(const FFTWBuffer&);
+    FFTWBuffer& operator=(const FFTWBuffer&);
+};
+
+/*
+ * Scratch buffers of a transform: the half spectrum of the real transforms,
+ * and the aligned copy of data FFTW can not work on where it is. They only
+ * grow, so once the largest transform has run nothing is allocated per call.
+ */
+template<typename _Tp> struct FFTWScratch
+{
+    FFTWBuffer<_Tp> half;
+    FFTWBuffer<_Tp> copy;
+};
+
+/*
+ * Plans of one precision, keyed by (kind, rows, cols, count, in place).
+ * count transforms of rows x cols are stacked one below the other. The FFTW
+ * planner is not thread safe, so plans are looked up and built under the
+ * planner mutex, and executed out of it through the new-array interface.
+ */
+template<typename _Tp> class FFTWPlanCache
+{
+public:
+
+    typedef typename FFTWTraits<_Tp>::Plan Plan;
+    typedef typename FFTWTraits<_Tp>::Complex Complex;
+
+    FFTWPlanCache(unsigned plannerFlags, Mutex* plannerMutex);
+    ~FFTWPlanCache();
+
+    void complexTransform(const Mat& src, Mat& dst, int count, bool inverse);
+    void forwardRealTransform(const Mat& src, Mat& dst, int count);
+    void inverseRealTransform(const Mat& src, Mat& dst, int count);
+
+private:
+
+    struct Key
+    {
+        int kind;
+        int rows;
+        int cols;
+        int count;
+        bool inPlace;
+
+        bool operator<(const Key& other) const
+        {
+            if(kind != other.kind) return (kind < other.kind);
+            if(rows != other.rows) return (rows < other.rows);
+            if(cols != other.cols) return (cols < other.cols);
+            if(count != other.count) return (count < other.count);
+            return (inPlace < other.inPlace);
+        }
+    };
+
+    /*
+     * Scratch of a transform, taken from the cache for the transform and
+     * given back when it ends, even by an exception
+     */
+    class ScratchLock
+    {
+    public:
+
+        ScratchLock(FFTWPlanCache* _cache) :
+            cache(_cache), scratch(_cache->acquireScratch()) {}
+        ~ScratchLock()
+        {
+            cache->releaseScratch(scratch);
+        }
+
+        FFTWScratch<_Tp>* operator->() const
+        {
+            return (scratch);
+        }
+
+    private:
+
+        FFTWPlanCache* cache;
+        FFTWScratch<_Tp>* scratch;
+
+        ScratchLock(const ScratchLock&);
+        ScratchLock& operator=(const ScratchLock&);
+    };
+
+    unsigned mPlannerFlags;
+    Mutex* mPlannerMutex;
+    map<Key, Plan> mPlans;
+
+    // One scratch per transform running at once, reused by later ones
+    vector<FFTWScratch<_Tp>*> mScratch;
+    Mutex mScratchMutex;
+
+    Plan getPlan(int kind, int rows, int cols, int count, bool inPlace);
+    Plan createPlan(int kind, int rows, int cols, int count, bool inPlace);
+
+    FFTWScratch<_Tp>* acquireScratch();
+    void releaseScratch(FFTWScratch<_Tp>* scratch);
+
+    FFTWPlanCache(const FFTWPlanCache&);
+    FFTWPlanCache& operator=(const FFTWPlanCache&);
+};
+
+template<typename _Tp>
+FFTWPlanCache<_Tp>::FFTWPlanCache(unsigned plannerFlags,
+        Mutex* plannerMutex) :
+    mPlannerFlags(plannerFlags), mPlannerMutex(plannerMutex)
+{
+}
+
+template<typename _Tp>
+FFTWPlanCache<_Tp>::~FFTWPlanCache()
+{
+    for(size_t i=0; i<mScratch.size(); i++)
+    {
+        delete mScratch[i];
+    }
+
+    AutoLock lock(*mPlannerMutex);
+    for(typename map<Key, Plan>::iterator it = mPlans.begin();
+            it != mPlans.end(); ++it)
+    {
+        FFTWTraits<_Tp>::destroy(it->second);
+    }
+}
+
+template<typename _Tp>
+FFTWScratch<_Tp>* FFTWPlanCache<_Tp>::acquireScratch()
+{
+    AutoLock lock(mScratchMutex);
+
+    if(mScratch.empty())
+    {
+        return (new FFTWScratch<_Tp>());
+    }
+
+    FFTWScratch<_Tp>* scratch = mScratch.back();
+    mScratch.pop_back();
+    return (scratch);
+}
+
+template<typename _Tp>
+void FFTWPlanCache<_Tp>::releaseScratch(FFTWScratch<_Tp>* scratch)
+{
+    AutoLock lock(mScratchMutex);
+    mScratch.push_back(scratch);
+}
+
+template<typename _Tp>
+typename FFTWPlanCache<_Tp>::Plan FFTWPlanCache<_Tp>::getPlan(int kind,
+        int rows, int cols, int count, bool inPlace)
+{
+    Key key;
+    key.kind = kind;
+    key.rows = rows;
+    key.cols = cols;
+    key.count = count;
+    key.inPlace = inPlace;
+
+    AutoLock lock(*mPlannerMutex);
+
+    typename map<Key, Plan>::iterator it = mPlans.find(key);
+    if(it == mPlans.end())
+    {
+        it = mPlans.insert(make_pair(key,
+                createPlan(kind, rows, cols, count, inPlace))).first;
+    }
+
+    return (it->second);
+}
+
+template<typename _Tp>
+typename FFTWPlanCache<_Tp>::Plan FFTWPlanCache<_Tp>::createPlan(int kind,
+        int rows, int cols, int count, bool inPlace)
+{
+    // Planning may overwrite the buffers, so plans are built on scratch ones
+    size_t complexSize = (size_t)count * rows * cols * sizeof(Complex);
+    FFTWBuffer<_Tp> in(complexSize);
+    FFTWBuffer<_Tp> out(complexSize);
+    void* outData = inPlace ? in.getData() : out.getData();
+    int size[] = {rows, cols};
+
+    Plan plan = 0;
+    switch(kind)
+    {
+    case FFTW_KIND_FORWARD:
+    case FFTW_KIND_INVERSE:
+        plan = FFTWTraits<_Tp>::planComplex(size, count,
+                (Complex*)in.getData(), (Complex*)outData,
+                (kind == FFTW_KIND_FORWARD) ? FFTW_FORWARD : FFTW_BACKWARD,
+                mPlannerFlags);
+        break;
+    case FFTW_KIND_FORWARD_REAL:
+        plan = FFTWTraits<_Tp>::planForwardReal(size, count,
+                (_Tp*)in.getData(), (Complex*)out.getData(), mPlannerFlags);
+        break;
+    case FFTW_KIND_INVERSE_REAL:
+        plan = FFTWTraits<_Tp>::planInverseReal(size, count,
+                (Complex*)in.getData(), (_Tp*)out.getData(), mPlannerFlags);
+        break;
+    }
+
+    if(plan == 0)
+    {
+        CV_Error(CV_StsError, "FFTW could not build a plan");
+    }
+
+    return (plan);
+}
+
+template<typename _Tp>
+void FFTWPlanCache<_Tp>::complexTransform(const Mat& src, Mat& dst,
+        int count, bool inverse)
+{
+    int rows = src.rows/count;
+    int cols = src.cols;
+    int kind = inverse ? FFTW_KIND_INVERSE : FFTW_KIND_FORWARD;
+
+    dst.create(src.rows, cols, src.type());
+
+    Complex* in = (Complex*)src.data;
+    Complex* out = (Complex*)dst.data;
+    if(src.isContinuous() && dst.isContinuous() &&
+            FFTWTraits<_Tp>::isAligned(in) && FFTWTraits<_Tp>::isAligned(out))
+    {
+        FFTWTraits<_Tp>::executeComplex(getPlan(kind, rows, cols, count,
+                in == out), in, out);
+        return;
+    }
+
+    // Regions of interest and unaligned data go through an aligned copy
+    ScratchLock scratch(this);
+    scratch->copy.reserve((size_t)src.rows * cols * sizeof(Complex));
+    Mat data(src.rows, cols, src.type(), scratch->copy.getData());
+    src.copyTo(data);
+    FFTWTraits<_Tp>::executeComplex(getPlan(kind, rows, cols, count, true),
+            (Complex*)data.data, (Complex*)data.data);
+    data.copyTo(dst);
+}
+
+template<typename _Tp>
+void FFTWPlanCache<_Tp>::forwardRealTransform(const Mat& src, Mat& dst,
+        int count)
+{
+    int rows = src.rows/count;
+    int cols = src.cols;
+    int halfCols = cols/2 + 1;
+
+    Plan plan = getPlan(FFTW_KIND_FORWARD_REAL, rows, cols, count, false);
+
+    ScratchLock scratch(this);
+    scratch->half.reserve((size_t)src.rows * halfCols * sizeof(Complex));
+    Complex* out = (Complex*)scratch->half.getData();
+
+    if(src.isContinuous() && FFTWTraits<_Tp>::isAligned(src.data))
+    {
+        FFTWTraits<_Tp>::executeForwardReal(plan, (_Tp*)src.data, out);
+    }
+    else {
+        scratch->copy.reserve((size_t)src.rows * cols * sizeof(_Tp));
+        Mat data(src.rows, cols, src.type(), scratch->copy.getData());
+        src.copyTo(data);
+        FFTWTraits<_Tp>::executeForwardReal(plan, (_Tp*)data.data, out);
+    }
+
+    // The other half of each spectrum is the conjugate of the computed one
+    dst.create(src.rows, cols, CV_MAKETYPE(DataType<_Tp>::depth, 2));
+    for(int k=0; k<count; k++)
+    {
+        const Complex* spectrum = out + k*rows*halfCols;
+        for(int i=0; i<rows; i++)
+        {
+            _Tp* row = dst.ptr<_Tp>(k*rows + i);
+            const Complex* computed = spectrum + i*halfCols;
+            const Complex* mirrored = spectrum + ((rows - i) % rows)*halfCols;
+            for(int j=0; j<halfCols; j++)
+            {
+                row[2*j] = computed[j][0];
+                row[2*j + 1] = computed[j][1];
+            }
+            for(int j=halfCols; j<cols; j++)
+            {
+                row[2*j] = mirrored[cols - j][0];
+                row[2*j + 1] = -mirrored[cols - j][1];
+            }
+        }
+    }
+}
+
+template<typename _Tp>
+void FFTWPlanCache<_Tp>::inverseRealTransform(const Mat& src, Mat& dst,
+        int count)
+{
+    int rows = src.rows/count;
+    int cols = src.cols;
+    int halfCols = cols/2 + 1;
+
+    Plan plan = getPlan(FFTW_KIND_INVERSE_REAL, rows, cols, count, false);
+
+    // The transform only reads half of the Hermitian spectrum, and destroys
+    // its input
+    ScratchLock scratch(this);
+    scratch->half.reserve((size_t)src.rows * halfCols * sizeof(Complex));
+    Complex* in = (Complex*)scratch->half.getData();
+    for(int i=0; i<src.rows; i++)
+    {
+        memcpy(in + i*halfCols, src.ptr(i), halfCols * sizeof(Complex));
+    }
+
+    dst.create(src.rows, cols, DataType<_Tp>::type);
+    if(dst.isContinuous() && FFTWTraits<_Tp>::isAligned(dst.data))
+    {
+        FFTWTraits<_Tp>::executeInverseReal(plan, in, (_Tp*)dst.data);
+    }
+    else {
+        scratch->copy.reserve((size_t)src.rows * cols * sizeof(_Tp));
+        Mat data(src.rows, cols, dst.type(), scratch->copy.getData());
+        FFTWTraits<_Tp>::executeInverseReal(plan, in, (_Tp*)data.data);
+        data.copyTo(dst);
+    }
+}
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                              FFTWFFTBackend                              ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+const char FFTW_WISDOM_MAGIC[] = "libfex-fftw-wisdom";
+
+/*
+ * FFTW plans, measured the first time each transform is requested.
+ *
+ * Complex transforms and the real transforms with a complex output or input
+ * run through FFTW. CCS packed real transforms and DFT_ROWS are handed over
+ * to cv::dft. The zero rows given by nonzeroRows are transformed as any
+ * other row.
+ *
+ * Batches run as FFTW_BATCH_SIZE transforms per FFTW call, which lets FFTW
+ * vectorize across transforms, with the calls spread over threads.
+ */
+class FFTWFFTBackend : public FFTBackend
+{
+public:
+
+    FFTWFFTBackend();
+
+    int getType() const;
+    void dft(const Mat& src, Mat& dst, int flags, int nonzeroRows);
+    void dftBatch(const Mat& src, Mat& dst, int count, int flags);
+
+    void saveWisdom(const string& filename) const;
+    void loadWisdom(const string& filename);
+
+    /*
+     * count stacked transforms in a single FFTW call
+     */
+    void transform(const Mat& src, Mat& dst, int count, int flags);
+
+private:
+
+    FFTWPlanCache<double> mDoublePlans;
+    FFTWPlanCache<float> mFloatPlans;
+
+    // Shared by every instance, the planner and wisdom are process-wide
+    static Mutex& getPlannerMutex();
+
+    static bool isSupported(const Mat& src, int flags);
+
+    template<typename _Tp>
+    static void transform(FFTWPlanCache<_Tp>& plans, const Mat& src, Mat& dst,
+            int count, int flags);
+};
+
+/*
+ * Class for parallel FFTW batches, one FFTW call per block
+ */
+class FFTWBatchBody
+{
+public:
+
+	FFTWBatchBody(FFTWFFTBackend* _backend, const Mat* _src, Mat* _dst,
+			int _rows, int _count, int _flags) :
+		backend(_backend), src(_src), dst(_dst), mRows(_rows),
+		mCount(_count), mFlags(_flags) {}
+
+	void operator() (const BlockedRange& range) const
+	{
+		for(int block=range.begin(); block!=range.end(); ++block)
+		{
+			int first = block*FFTW_BATCH_SIZE;
+			int count = min(FFTW_BATCH_SIZE, mCount - first);
+			Mat dstBlock = dst->rowRange(first*mRows, (first + count)*mRows);
+			backend->transform(src->rowRange(first*mRows,
+					(first + count)*mRows), dstBlock, count, mFlags);
+		}
+	}
+
+private:
+
+	FFTWFFTBackend* backend;
+	const Mat* src;
+	Mat* dst;
+	int mRows;
+	int mCount;
+	int mFlags;
+};
+
+FFTWFFTBackend::FFTWFFTBackend() :
+    mDoublePlans(FFTW_MEASURE, &getPlannerMutex()),
+    mFloatPlans(FFTW_MEASURE, &getPlannerMutex())
+{
+}
+
+int FFTWFFTBackend::getType() const
+{
+    return (FFT_BACKEND_FFTW);
+}
+
+void FFTWFFTBackend::dft(const Mat& src, Mat& dst, int flags,
+        int nonzeroRows)
+{
+    if(isSupported(src, flags))
+    {
+        transform(src, dst, 1, flags);
+    }
+    else {
+        cv::dft(src, dst, flags, nonzeroRows);
+    }
+}
+
+void FFTWFFTBackend::dftBatch(const Mat& src, Mat& dst, int count, int flags)
+{
+    if(!isSupported(src, flags))
+    {
+        FFTBackend::dftBatch(src, dst, count, flags);
+        return;
+    }
+
+    CV_Assert((count > 0) && (src.rows % count == 0));
+
+    // Keeps the input alive if dst is reallocated over it
+    Mat input = src;
+    dst.create(src.rows, src.cols, getOutputType(src.type(), flags));
+
+    FFTWBatchBody fftwBatchBody(this, &input, &dst, src.rows/count, count,
+            flags);
+
+    parallel_for(BlockedRange(0, (count + FFTW_BATCH_SIZE - 1)/
+            FFTW_BATCH_SIZE), fftwBatchBody);
+}
+
+void FFTWFFTBackend::transform(const Mat& src, Mat& dst, int count,
+        int flags)
+{
+    if(src.depth() == CV_64F)
+    {
+        transform(mDoublePlans, src, dst, count, flags);
+    }
+    else {
+        transform(mFloatPlans, src, dst, count, flags);
+    }
+}
+
+bool FFTWFFTBackend::isSupported(const Mat& src, int flags)
+{
+    bool inverse = (flags & DFT_INVERSE) != 0;
+    return (((flags & DFT_ROWS) == 0) && (src.dims <= 2) && !src.empty() &&
+            ((src.depth() == CV_32F) || (src.depth() == CV_64F)) &&
+            ((src.channels() == 2) || ((src.channels() == 1) && !inverse &&
+            ((flags & DFT_COMPLEX_OUTPUT) != 0))));
+}
+
+template<typename _Tp>
+void FFTWFFTBackend::transform(FFTWPlanCache<_Tp>& plans, const Mat& src,
+        Mat& dst, int count, int flags)
+{
+    if(src.channels() == 1)
+    {
+        plans.forwardRealTransform(src, dst, count);
+    }
+    else if((flags & DFT_INVERSE) && (flags & DFT_REAL_OUTPUT))
+    {
+        plans.inverseRealTransform(src, dst, count);
+    }
+    else {
+        plans.complexTransform(src, dst, count, (flags & DFT_INVERSE) != 0);
+    }
+
+    if(flags & DFT_SCALE)
+    {
+        dst.convertTo(dst, -1, 1.0/((double)(dst.rows/count) * dst.cols));
+    }
+}
+
+void FFTWFFTBackend::saveWisdom(const string& filename) const
+{
+    AutoLock lock(getPlannerMutex());
+
+    ofstream file(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!file)
+    {
+        CV_Error(CV_StsError, "Could not create " + filename);
+    }
+
+    // Double and single precision wisdom, each one preceded by its length
+    char* wisdom[] = {FFTWTraits<double>::exportWisdom(),
+            FFTWTraits<float>::exportWisdom()};
+    file << FFTW_WISDOM_MAGIC << '\n';
+    for(int i=0; i<2; i++)
+    {
+        size_t length = (wisdom[i] != 0) ? strlen(wisdom[i]) : 0;
+        file << length << '\n';
+        file.write(wisdom[i], length);
+        free(wisdom[i]);
+    }
+
+    if(!file)
+    {
+        CV_Error(CV_StsError, "Could not write " + filename);
+    }
+}
+
+void FFTWFFTBackend::loadWisdom(const string& filename)
+{
+    AutoLock lock(getPlannerMutex());
+
+    ifstream file(filename.c_str(), ios::in | ios::binary);
+    if(!file)
+    {
+        CV_Error(CV_StsError, "Could not open " + filename);
+    }
+
+    string magic;
+    getline(file, magic);
+    if(magic != FFTW_WISDOM_MAGIC)
+    {
+        CV_Error(CV_StsError, filename + " is not an FFTW wisdom file");
+    }
+
+    string wisdom[2];
+    for(int i=0; i<2; i++)
+    {
+        size_t length = 0;
+        file >> length;
+        file.ignore(1);
+        wisdom[i].resize(length);
+        if(length > 0)
+        {
+            file.read(&wisdom[i][0], length);
+        }
+    }
+
+    if(!file || !FFTWTraits<double>::importWisdom(wisdom[0].c_str()) ||
+            !FFTWTraits<float>::importWisdom(wisdom[1].c_str()))
+    {
+        CV_Error(CV_StsError, filename + " is truncated or corrupted");
+    }
+}
+
+Mutex& FFTWFFTBackend::getPlannerMutex()
+{
+    static Mutex mutex;
+    return (mutex);
+}
+
+#endif
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                              DFTBatchBody                                ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Class for parallel batches, one dft() per transform
+ */
+class DFTBatchBody
+{
+public:
+
+	DFTBatchBody(FFTBackend* _backend, const Mat* _src, Mat* _dst, int _rows,
+			int _flags) :
+		backend(_backend), src(_src), dst(_dst), mRows(_rows),
+		mFlags(_flags) {}
+
+	void operator() (const BlockedRange& range) const
+	{
+		for(int index=range.begin(); index!=range.end(); ++index)
+		{
+			Mat dstTransform = dst->rowRange(index*mRows, (index + 1)*mRows);
+			backend->dft(src->rowRange(index*mRows, (index + 1)*mRows),
+					dstTransform, mFlags);
+		}
+	}
+
+private:
+
+	FFTBackend* backend;
+	const Mat* src;
+	Mat* dst;
+	int mRows;
+	int mFlags;
+};
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                                FFTBackend                                ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+FFTBackend::~FFTBackend()
+{
+}
+
+void FFTBackend::dftBatch(const Mat& src, Mat& dst, int count, int flags)
+{
+    CV_Assert((count > 0) && (src.rows % count == 0));
+
+    // Keeps the input alive if dst is reallocated over it
+    Mat input = src;
+    dst.create(src.rows, src.cols, getOutputType(src.type(), flags));
+
+    DFTBatchBody dftBatchBody(this, &input, &dst, src.rows/count, flags);
+
+    parallel_for(BlockedRange(0, count), dftBatchBody);
+}
+
+int FFTBackend::getOutputType(int type, int flags)
+{
+    int depth = CV_MAT_DEPTH(type);
+    bool inverse = (flags & DFT_INVERSE) != 0;
+
+    if(CV_MAT_CN(type) == 2)
+    {
+        return ((inverse && (flags & DFT_REAL_OUTPUT)) ?
+                CV_MAKETYPE(depth, 1) : type);
+    }
+    return ((!inverse && (flags & DFT_COMPLEX_OUTPUT)) ?
+            CV_MAKETYPE(depth, 2) : type);
+}
+
+void FFTBackend::saveWisdom(const string& filename) const
+{
+}
+
+void FFTBackend::loadWisdom(const string& filename)
+{
+}
+
+bool FFTBackend::isAvailable(int type)
+{
+#ifdef HAVE_FFTW3
+    return ((type == FFT_BACKEND_OPENCV) || (type == FFT_BACKEND_FFTW));
+#else
+    return (type == FFT_BACKEND_OPENCV);
+#endif
+}
+
+Ptr<FFTBackend> FFTBackend::create(int type)
+{
+    if(!isAvailable(type))
+    {
+        CV_Error(CV_StsBadArg, "FFT backend not available in this build");
+    }
+
+#ifdef HAVE_FFTW3
+    if(type == FFT_BACKEND_FFTW)
+    {
+        return (Ptr<FFTBackend>(new FFTWFFTBackend()));
+    }
+#endif
+    return (Ptr<FFTBackend>(new OpenCVFFTBackend()));
+}
+
+Ptr<FFTBackend> FFTBackend::getDefault()
+{
+    AutoLock lock(getMutex());
+    return (getDefaultBackend());
+}
+
+void FFTBackend::setDefault(const Ptr<FFTBackend>& backend)
+{
+    CV_Assert(!backend.empty());
+
+    AutoLock lock(getMutex());
+    getDefaultBackend() = backend;
+}
+
+Ptr<FFTBackend>& FFTBackend::getDefaultBackend()
+{
+    static Ptr<FFTBackend> backend(new OpenCVFFTBackend());
+    return (backend);
+}
+
+Mutex& FFTBackend::getMutex()
+{
+    static Mutex mutex;
+    return (mutex);
+}
+
+}
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef FFTBACKEND_HPP_
+#define FFTBACKEND_HPP_
+
+#include "opencv2/opencv.hpp"
+#include <string>
+
+namespace fex
+{
+
+using namespace cv;
+using namespace std;
+
+/*
+ * FFT backends.
+ *
+ * FFT_BACKEND_OPENCV runs cv::dft. FFT_BACKEND_FFTW runs FFTW plans, built
+ * the first time a size, type and kind of transform is requested and reused
+ * afterwards. It is only available when libfex is built with FFTW.
+ */
+enum
+{
+    FFT_BACKEND_OPENCV = 0,
+    FFT_BACKEND_FFTW = 1
+};
+
+/*
+ * Discrete Fourier transforms used by the filtering code.
+ *
+ * dft() and idft() follow cv::dft and cv::idft for CV_32F and CV_64F data,
+ * backends handing the cases they do not implement over to cv::dft. They can
+ * be called from several threads at once.
+ *
+ * Wisdom is what a backend learns while planning. Saving it at the end of a
+ * run and loading it in the next one avoids planning again. Backends that do
+ * not plan ignore it.
+ */
+class FFTBackend
+{
+public:
+
+    virtual ~FFTBackend();
+
+    virtual int getType() const = 0;
+
+    virtual void dft(const Mat& src, Mat& dst, int flags = 0,
+            int nonzeroRows = 0) = 0;
+    void idft(const Mat& src, Mat& dst, int flags = 0, int nonzeroRows = 0);
+
+    /*
+     * count transforms of the same size at once, stacked one below the other
+     * in src and dst (src.rows/count rows each). By default they run in
+     * parallel through dft().
+     */
+    virtual void dftBatch(const Mat& src, Mat& dst, int count, int flags = 0);
+    void idftBatch(const Mat& src, Mat& dst, int count, int flags = 0);
+
+    /*
+     * Type of the output of dft() for an input type and flags
+     */
+    static int getOutputType(int type, int flags);
+
+    virtual void saveWisdom(const string& filename) const;
+    virtual void loadWisdom(const string& filename);
+
+    static bool isAvailable(int type);
+    static Ptr<FFTBackend> create(int type);
+
+    /*
+     * Process-wide backend used by ImageHelpers, FFT_BACKEND_OPENCV unless
+     * changed. Transforms already running when it is changed finish with the
+     * previous one.
+     */
+    static Ptr<FFTBackend> getDefault();
+    static void setDefault(const Ptr<FFTBackend>& backend);
+
+private:
+
+    static Ptr<FFTBackend>& getDefaultBackend();
+    static Mutex& getMutex();
+};
+
+inline void FFTBackend::idft(const Mat& src, Mat& dst, int flags,
+        int nonzeroRows)
+{
+    dft(src, dst, flags | DFT_INVERSE, nonzeroRows);
+}
+
+inline void FFTBackend::idftBatch(const Mat& src, Mat& dst, int count,
+        int flags)
+{
+    dftBatch(src, dst, count, flags | DFT_INVERSE);
+}
+
+}
+
+#endif /* FFTBACKEND_HPP_ */
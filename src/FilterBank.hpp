@@ -0,0 +1,181 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef FILTERBANK_HPP_
+#define FILTERBANK_HPP_
+
+// TODO: Check really needed header files, including all OpenCV headers
+// is way too much
+#include "opencv2/opencv.hpp"
+#include "ImageHelpers.hpp"
+
+namespace fex
+{
+
+using namespace cv;
+
+/*
+ * Abstract bank of complex filters, as consumed by GaborFilteringPlan and
+ * everything built on it (FilteringHelpers, GaborFeatureSet).
+ *
+ * Every kernel of the bank is centred on a common nominal frame of
+ * getFilterSizeX() x getFilterSizeY(), the centre of a kernel being at
+ * (rows/2, cols/2). Kernels may be smaller than the frame.
+ *
+ * Implementations must be safe to read from several threads at once.
+ */
+template<typename _Tp> class FilterBank
+{
+public:
+
+    virtual ~FilterBank() {}
+
+    virtual int getNumFilters() const = 0;
+    virtual int getFilterSizeX() const = 0;
+    virtual int getFilterSizeY() const = 0;
+
+    /*
+     * Spatial kernel of a filter. Banks defined in the frequency domain
+     * return an empty kernel, and their filters are always applied through
+     * their spectra.
+     */
+    virtual Mat_<complex<_Tp> > getKernel(int index) const = 0;
+
+    /*
+     * Spectrum of a filter with its centre placed at (offsetX, offsetY) of a
+     * dftSizeX x dftSizeY frame. By default, the DFT of the spatial kernel.
+     */
+    virtual void computeKernelFFT(int index, Mat_<Vec<_Tp, 2> >& dst,
+            int dftSizeX, int dftSizeY, int offsetX, int offsetY) const;
+
+    /*
+     * Real kernels have Hermitian spectra, so they are applied through the
+     * CCS packed half spectrum computed by computeRealKernelFFT, placed as
+     * in computeKernelFFT. By default no kernel is taken as real.
+     */
+    virtual bool isRealKernel(int index) const;
+    virtual void computeRealKernelFFT(int index, Mat_<_Tp>& dst,
+            int dftSizeX, int dftSizeY, int offsetX, int offsetY) const;
+
+    /*
+     * Recursive (IIR) form of a filter, for FILTERING_RECURSIVE. Only banks
+     * answering true to hasRecursiveForm() have to provide it.
+     */
+    virtual bool hasRecursiveForm() const;
+    virtual void computeRecursiveKernel(int index, RecursiveGaborKernel& dst,
+            int offsetX, int offsetY) const;
+
+    /*
+     * Radius, in radians per pixel, of the band holding the spectrum of the
+     * envelope of the responses of a filter, which the magnitudes follow.
+     * Responses can be sampled every floor(pi/bandwidth) pixels (see
+     * FilteringHelpers::getDownSamplingRatios). By default the whole band,
+     * pi, so responses are kept at full resolution.
+     */
+    virtual double getBandwidth(int index) const;
+
+    /*
+     * Copy of the bank, owned by the caller
+     */
+    virtual FilterBank<_Tp>* clone() const = 0;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+template<typename _Tp>
+void FilterBank<_Tp>::computeKernelFFT(int index, Mat_<Vec<_Tp, 2> >& dst,
+        int dftSizeX, int dftSizeY, int offsetX, int offsetY) const
+{
+    Mat_<complex<_Tp> > kernel = getKernel(index);
+    CV_Assert(!kernel.empty());
+
+    int top = offsetX - kernel.rows/2;
+    int left = offsetY - kernel.cols/2;
+
+    CV_Assert((top >= 0) && (left >= 0) &&
+            (top + kernel.rows <= dftSizeX) &&
+            (left + kernel.cols <= dftSizeY));
+
+    Mat_<complex<_Tp> > placed;
+    copyMakeBorder(kernel, placed, top, 0, left, 0, BORDER_CONSTANT,
+            Scalar::all(0));
+
+    ImageHelpers::complexDFT(placed, dst, Size(dftSizeY, dftSizeX));
+}
+
+template<typename _Tp>
+bool FilterBank<_Tp>::isRealKernel(int index) const
+{
+    return (false);
+}
+
+template<typename _Tp>
+void FilterBank<_Tp>::computeRealKernelFFT(int index, Mat_<_Tp>& dst,
+        int dftSizeX, int dftSizeY, int offsetX, int offsetY) const
+{
+    Mat_<complex<_Tp> > kernel = getKernel(index);
+    CV_Assert(!kernel.empty());
+
+    int top = offsetX - kernel.rows/2;
+    int left = offsetY - kernel.cols/2;
+
+    CV_Assert((top >= 0) && (left >= 0) &&
+            (top + kernel.rows <= dftSizeX) &&
+            (left + kernel.cols <= dftSizeY));
+
+    Mat_<_Tp> planes[2];
+    split(kernel, planes);
+
+    Mat_<_Tp> placed;
+    copyMakeBorder(planes[0], placed, top, 0, left, 0, BORDER_CONSTANT,
+            Scalar::all(0));
+
+    ImageHelpers::realDFT(placed, dst, Size(dftSizeY, dftSizeX));
+}
+
+template<typename _Tp>
+bool FilterBank<_Tp>::hasRecursiveForm() const
+{
+    return (false);
+}
+
+template<typename _Tp>
+double FilterBank<_Tp>::getBandwidth(int index) const
+{
+    return (M_PI);
+}
+
+template<typename _Tp>
+void FilterBank<_Tp>::computeRecursiveKernel(int index,
+        RecursiveGaborKernel& dst, int offsetX, int offsetY) const
+{
+    CV_Error(CV_StsNotImplemented,
+            "This filter bank has no recursive form");
+}
+
+}
+
+#endif /* FILTERBANK_HPP_ */
@@ -28,43 +28,626 @@
 #include "opencv2/opencv.hpp"
 #include "opencv2/core/internal.hpp"
 #include "ImageHelpers.hpp"
+#include "FilterBank.hpp"
 #include "GaborSet.hpp"
 #include "GaborFilter.hpp"
+#include "GaborFilteringPlan.hpp"
+#include "FilteringWorkspace.hpp"
 #include <vector>
 #include <map>
 
 namespace fex
 {
 
+/*
+ * Downsampling methods.
+ *
+ * DOWNSAMPLING_SPATIAL inverse transforms each response at full size and
+ * then runs ImageHelpers::downSample. DOWNSAMPLING_FOLD folds the spectrum
+ * of the FFT filter responses instead, and inverse transforms them at the
+ * reduced size, giving the same samples. DOWNSAMPLING_CROP keeps the band
+ * around DC, which anti-aliases kernels whose pass band fits in it and
+ * drops the response of the others.
+ *
+ * Both need 1/ratio to be an integer step dividing the DFT size of the plan
+ * (see GaborFilteringPlan). DOWNSAMPLING_FOLD falls back to
+ * DOWNSAMPLING_SPATIAL otherwise, and for filters convolved in the spatial
+ * domain or with real spectra.
+ *
+ * DOWNSAMPLING_AVERAGE_POOLING and DOWNSAMPLING_MAX_POOLING keep the mean
+ * or the maximum of the magnitudes of each block of step x step pixels,
+ * instead of a single sample of the response. They are computed with the
+ * magnitudes (see ImageHelpers::zmuMagnitude), and need 1/ratio to be an
+ * integer step.
+ */
+enum
+{
+    DOWNSAMPLING_SPATIAL = 0,
+    DOWNSAMPLING_FOLD = 1,
+    DOWNSAMPLING_CROP = 2,
+    DOWNSAMPLING_AVERAGE_POOLING = 3,
+    DOWNSAMPLING_MAX_POOLING = 4
+};
+
 class FilteringHelpers
 {
 public:
 
-    template<typename _Tp>
+    /*
+     * Any FilterBank can be applied, GaborSet being the usual one.
+     *
+     * The images may be 8 or 16 bit ones (uchar, ushort) instead of _Tp
+     * ones. They are converted to _Tp while being copied into the padded
+     * input of the forward transform, without a converted copy of the
+     * whole vector.
+     *
+     * They may also have several channels (Vec<uchar, 3> for instance).
+     * All the channels of a batch of images are transformed at once, and
+     * filtered by the same filter spectra. Their features are combined as
+     * channelCombination says (see CHANNELS_CONCATENATE).
+     *
+     * Features are the magnitudes of the responses, computed as
+     * magnitudeMode says (see MAGNITUDE_EXACT).
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyGaborSetToMatVector(
+            vector<Mat_<_Ip> >& mat, const FilterBank<_Tp>& filterBank,
+            Mat_<_Tp>& features, bool needZMUNormalization,
+            bool needDownSampling, _Tp downSamplingRatio = 1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    /*
+     * Same as above, reusing the filter spectra of a plan built for the
+     * geometry of the images. Workspaces are taken from the given pool, or
+     * from a pool of the call when none is given. Keeping a pool across
+     * calls avoids any allocation per image after the first ones.
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyGaborSetToMatVector(
+            vector<Mat_<_Ip> >& mat, const GaborFilteringPlan<_Tp>& plan,
+            Mat_<_Tp>& features, bool needZMUNormalization,
+            bool needDownSampling, _Tp downSamplingRatio = 1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT,
+            FilteringWorkspacePool* workspaces = 0);
+
+    /*
+     * Several filter banks applied to the same images, giving one feature
+     * matrix per bank. The forward spectrum of each image is computed once
+     * and filtered by every bank, so the banks are planned at a common DFT
+     * size, which may differ from the size each of them would get alone.
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyFilterBanksToMatVector(
+            vector<Mat_<_Ip> >& mat,
+            const vector<const FilterBank<_Tp>*>& filterBanks,
+            vector<Mat_<_Tp> >& features, bool needZMUNormalization,
+            bool needDownSampling, _Tp downSamplingRatio = 1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    /*
+     * Same as above with plans built for the geometry of the images, which
+     * must all have the same DFT size (see GaborFilteringPlan).
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyFilterBanksToMatVector(
+            vector<Mat_<_Ip> >& mat,
+            const vector<const GaborFilteringPlan<_Tp>*>& plans,
+            vector<Mat_<_Tp> >& features, bool needZMUNormalization,
+            bool needDownSampling, _Tp downSamplingRatio = 1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT,
+            FilteringWorkspacePool* workspaces = 0);
+
+    /*
+     * Same as the ones above with a downsampling ratio per filter, such as
+     * the ones given by getDownSamplingRatios(). The features of an image
+     * are the magnitudes of each filter one after the other, with the size
+     * getFilteredImageSize() gives for its ratio.
+     *
+     * The ratios are applied as DOWNSAMPLING_SPATIAL does, or by pooling.
+     * DOWNSAMPLING_FOLD and DOWNSAMPLING_CROP fall back to
+     * DOWNSAMPLING_SPATIAL, so the plans must be built with a step of 1.
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyGaborSetToMatVector(
+            vector<Mat_<_Ip> >& mat, const FilterBank<_Tp>& filterBank,
+            Mat_<_Tp>& features, bool needZMUNormalization,
+            const vector<_Tp>& downSamplingRatios,
+            int downSamplingMethod = DOWNSAMPLING_SPATIAL,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    template<typename _Tp, typename _Ip>
     static void imageApplyGaborSetToMatVector(
-            vector<Mat_<_Tp> >& mat, const GaborSet<_Tp> filterSet,
+            vector<Mat_<_Ip> >& mat, const GaborFilteringPlan<_Tp>& plan,
             Mat_<_Tp>& features, bool needZMUNormalization,
-            bool needDownSampling, _Tp downSamplingRatio = 1.0f);
+            const vector<_Tp>& downSamplingRatios,
+            int downSamplingMethod = DOWNSAMPLING_SPATIAL,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT,
+            FilteringWorkspacePool* workspaces = 0);
 
+    /*
+     * Several plans with the ratios of each of them
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyFilterBanksToMatVector(
+            vector<Mat_<_Ip> >& mat,
+            const vector<const GaborFilteringPlan<_Tp>*>& plans,
+            vector<Mat_<_Tp> >& features, bool needZMUNormalization,
+            const vector<vector<_Tp> >& downSamplingRatios,
+            int downSamplingMethod = DOWNSAMPLING_SPATIAL,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT,
+            FilteringWorkspacePool* workspaces = 0);
+
+    /*
+     * Downsampling ratio of each filter of a bank: 1/floor(pi/bandwidth),
+     * the coarsest integer step keeping the band of its envelope (see
+     * FilterBank::getBandwidth). Coarse scales of a GaborSet get coarser
+     * steps than fine ones.
+     */
+    template<typename _Tp>
+    static void getDownSamplingRatios(const FilterBank<_Tp>& filterBank,
+            vector<_Tp>& ratios);
+
+    /*
+     * Number of samples of a response downsampled by ratio, spatially or by
+     * pooling
+     */
+    static int getFilteredImageSize(Size imageSize, double ratio);
+
+    /*
+     * Magnitudes of the responses of an image to every filter, one row per
+     * filter, computed as magnitudeMode says (see MAGNITUDE_EXACT).
+     */
+    template<typename _Tp>
+    static void imageApplyGaborSet(Mat_<_Tp> image,
+            const FilterBank<_Tp>& filterBank, Mat_<_Tp>& dst,
+            bool needZMUNorm, bool needDownSampl, _Tp ratio=1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    template<typename _Tp>
+    static void imageApplyGaborSet(Mat_<_Tp> image,
+            const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+            bool needZMUNorm, bool needDownSampl, _Tp ratio=1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    /*
+     * Same as above, with the image spectra and every scratch buffer taken
+     * from a workspace. Keeping the workspace, and dst, across calls on
+     * images of the plan geometry avoids any allocation per image.
+     */
     template<typename _Tp>
     static void imageApplyGaborSet(Mat_<_Tp> image,
-            GaborSet<_Tp> filterSet, Mat_<_Tp>& dst,
-            bool needZMUNorm, bool needDownSampl, _Tp ratio=1.0f);
+            const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+            FilteringWorkspace& workspace, bool needZMUNorm,
+            bool needDownSampl, _Tp ratio=1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    /*
+     * Same as above, given the image spectra the plan needs: the complex one
+     * if it has complex spectra, the CCS packed one if it has real spectra.
+     * The responses of all the FFT filters are inverse transformed at once.
+     */
+    template<typename _Tp>
+    static void imageApplyGaborSet(Mat_<_Tp> image,
+            Mat_<Vec<_Tp, 2> > imageFFT, Mat_<_Tp> imageCCS,
+            const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+            bool needZMUNorm, bool needDownSampl, _Tp ratio=1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    /*
+     * Same as above, with the scratch buffers taken from a workspace. When
+     * dst already has the size of the result, it is written in place. The
+     * image may have any depth, it is only converted to _Tp for filters
+     * convolved in the spatial domain.
+     *
+     * For multi-channel images, the spectra are those of the given channel.
+     * With CHANNELS_SUM or CHANNELS_MAX, its magnitudes are combined with
+     * those of the channels already in dst, which must have the size of the
+     * result.
+     *
+     * When ratios gives a ratio per filter, they are used instead of ratio
+     * as in imageApplyGaborSetToMatVector, and dst is a single row.
+     */
+    template<typename _Tp, typename _Ip>
+    static void imageApplyGaborSet(Mat_<_Ip> image,
+            Mat_<Vec<_Tp, 2> > imageFFT, Mat_<_Tp> imageCCS,
+            const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+            FilteringWorkspace& workspace, bool needZMUNorm,
+            bool needDownSampl, _Tp ratio=1.0f,
+            int downSamplingMethod = DOWNSAMPLING_FOLD, int channel = 0,
+            int channelCombination = CHANNELS_CONCATENATE,
+            int magnitudeMode = MAGNITUDE_EXACT, const _Tp* ratios = 0);
+
+    /*
+     * Overlap-save filtering of large images. The image is filtered in tiles
+     * of a fixed DFT size, run in parallel, instead of being padded and
+     * transformed as a whole, so the spectra being worked on stay in cache.
+     *
+     * The responses are the linear convolutions of the image with the
+     * kernels centred on each pixel, the ones the whole image FFT filtering
+     * and FILTERING_DIRECT give. Responses are downsampled as
+     * ImageHelpers::downSample with INTER_NEAREST does.
+     *
+     * Tiles are the DFT frames of the tile plan, the plan of the bank for an
+     * image of getTileSize(), which must only use FILTERING_FFT. Each tile
+     * writes its magnitudes straight to dst. With needZMUNorm the tiles are
+     * filtered twice, first for the normalization statistics of each filter.
+     */
+    template<typename _Tp>
+    static void imageApplyGaborSetTiled(Mat_<_Tp> image,
+            const FilterBank<_Tp>& filterBank, Mat_<_Tp>& dst,
+            bool needZMUNorm, bool needDownSampl, _Tp ratio=1.0f,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    template<typename _Tp>
+    static void imageApplyGaborSetTiled(Mat_<_Tp> image,
+            const GaborFilteringPlan<_Tp>& tilePlan, Mat_<_Tp>& dst,
+            bool needZMUNorm, bool needDownSampl, _Tp ratio=1.0f,
+            int magnitudeMode = MAGNITUDE_EXACT);
+
+    /*
+     * Image size of the tile plans of a bank: at least FILTERING_TILE_SIZE,
+     * and large enough for half of each tile to be valid output.
+     */
+    template<typename _Tp>
+    static Size getTileSize(const FilterBank<_Tp>& filterBank);
+
+    /*
+     * Pixels a tile needs before its first valid one, past the filter centre
+     */
+    static int getTileMargin(int filterSize);
+
+    /*
+     * Integer step of a downsampling ratio, 0 if 1/ratio is not an integer
+     */
+    static int getDownSamplingStep(double ratio);
+
+    /*
+     * Plan step for a downsampling setup: the step when the method works in
+     * the frequency domain, 1 otherwise.
+     */
+    static int getPlanDownSamplingStep(bool needDownSampling, double ratio,
+            int downSamplingMethod);
+
+private:
+
+    /*
+     * Filtering of the images by one or more plans, into one feature matrix
+     * per plan. ratios holds the ratios of the filters of each plan, or is
+     * null when they all use downSamplingRatio.
+     */
+    template<typename _Tp, typename _Ip>
+    static void applyFilterSets(vector<Mat_<_Ip> >& mat, int numPlans,
+            const GaborFilteringPlan<_Tp>* const* plans, Mat_<_Tp>* features,
+            bool needZMUNormalization, bool needDownSampling,
+            _Tp downSamplingRatio, const _Tp* const* ratios,
+            int downSamplingMethod, int channelCombination,
+            int magnitudeMode, FilteringWorkspacePool* workspaces);
 
 };
 
+inline int FilteringHelpers::getDownSamplingStep(double ratio)
+{
+    int step = cvRound(1.0/ratio);
+    return (((step > 0) && (std::abs(step*ratio - 1) < 1e-6)) ? step : 0);
+}
+
+inline int FilteringHelpers::getTileMargin(int filterSize)
+{
+    return (filterSize - 1 - filterSize/2);
+}
+
+inline int FilteringHelpers::getFilteredImageSize(Size imageSize,
+        double ratio)
+{
+    return (cvRound(imageSize.height*ratio)*cvRound(imageSize.width*ratio));
+}
+
+inline int FilteringHelpers::getPlanDownSamplingStep(bool needDownSampling,
+        double ratio, int downSamplingMethod)
+{
+    int step = getDownSamplingStep(ratio);
+    if(!needDownSampling || (step == 0) ||
+            ((downSamplingMethod != DOWNSAMPLING_FOLD) &&
+            (downSamplingMethod != DOWNSAMPLING_CROP)))
+    {
+        return (1);
+    }
+    return (step);
+}
+
+// Images whose spectra are computed in a single batch
+const int FILTERING_BATCH_IMAGES = 16;
+
+// Smallest side of the tiles of FilteringHelpers::imageApplyGaborSetTiled.
+// A double precision complex tile takes 256 KB, so the spectrum, product
+// and response of a tile stay in the L2 cache.
+const int FILTERING_TILE_SIZE = 128;
+
 /*
  ==============================================================================
  ==============================================================================
- ==                           ApplyFilterSetBody                             ==
+ ==                           TiledFilteringBody                             ==
  ==============================================================================
  ==============================================================================
  */
 
 /*
- * Template class for parallel filtering
+ * Template class for parallel overlap-save filtering of the tiles of an
+ * image. Only the tile being filtered is kept, each one writing the output
+ * samples it holds.
  */
 template<typename _Tp>
+class TiledFilteringBody
+{
+public:
+
+	/*
+	 * Constructors
+	 *
+	 * The first one writes the magnitudes of the responses to the feature
+	 * rows of dst, normalized with the means and standard deviations of the
+	 * filters when they are given. The second one adds the sums of the real
+	 * and imaginary parts of the responses, and of their squared
+	 * magnitudes, to sums, three per filter, which are normalization
+	 * statistics.
+	 */
+	TiledFilteringBody(Mat_<_Tp> _image, const GaborFilteringPlan<_Tp>& _plan,
+			const int* _rowSources, int _outputRows, const int* _colSources,
+			int _outputCols, int _tileCols, const Vec<_Tp, 2>* _means,
+			const _Tp* _stds, int _magnitudeMode, Mat_<_Tp> _dst,
+			FilteringWorkspacePool& _workspaces);
+	TiledFilteringBody(Mat_<_Tp> _image, const GaborFilteringPlan<_Tp>& _plan,
+			const int* _rowSources, int _outputRows, const int* _colSources,
+			int _outputCols, int _tileCols, double* _sums, Mutex& _sumsMutex,
+			FilteringWorkspacePool& _workspaces);
+
+	/*
+	 * TBB operator
+	 */
+	void operator() (const BlockedRange& range ) const;
+
+private:
+
+	/*
+	 * Input and output arguments
+	 */
+	Mat_<_Tp> image;
+	// One row of features per filter
+	Mat_<_Tp> dst;
+	// Statistics of the task are added in one go, under the mutex
+	double* sums;
+	Mutex* sumsMutex;
+
+	/*
+	 * Arguments needed for computation
+	 */
+	const GaborFilteringPlan<_Tp>* mPlan;
+	// Image row and column each output sample is taken from
+	const int* mRowSources;
+	int mOutputRows;
+	const int* mColSources;
+	int mOutputCols;
+	int mTileCols;
+	// Normalization of each filter, or null
+	const Vec<_Tp, 2>* mMeans;
+	const _Tp* mStds;
+	int mMagnitudeMode;
+	FilteringWorkspacePool* mWorkspaces;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/**************
+ * Constructors
+ **************/
+template<typename _Tp>
+TiledFilteringBody<_Tp>::TiledFilteringBody(Mat_<_Tp> _image,
+		const GaborFilteringPlan<_Tp>& _plan, const int* _rowSources,
+		int _outputRows, const int* _colSources, int _outputCols,
+		int _tileCols, const Vec<_Tp, 2>* _means, const _Tp* _stds,
+		int _magnitudeMode, Mat_<_Tp> _dst,
+		FilteringWorkspacePool& _workspaces) :
+		image(_image), dst(_dst), sums(0), sumsMutex(0), mPlan(&_plan),
+		mRowSources(_rowSources), mOutputRows(_outputRows),
+		mColSources(_colSources), mOutputCols(_outputCols),
+		mTileCols(_tileCols), mMeans(_means), mStds(_stds),
+		mMagnitudeMode(_magnitudeMode), mWorkspaces(&_workspaces) {}
+
+template<typename _Tp>
+TiledFilteringBody<_Tp>::TiledFilteringBody(Mat_<_Tp> _image,
+		const GaborFilteringPlan<_Tp>& _plan, const int* _rowSources,
+		int _outputRows, const int* _colSources, int _outputCols,
+		int _tileCols, double* _sums, Mutex& _sumsMutex,
+		FilteringWorkspacePool& _workspaces) :
+		image(_image), sums(_sums), sumsMutex(&_sumsMutex), mPlan(&_plan),
+		mRowSources(_rowSources), mOutputRows(_outputRows),
+		mColSources(_colSources), mOutputCols(_outputCols),
+		mTileCols(_tileCols), mMeans(0), mStds(0),
+		mMagnitudeMode(MAGNITUDE_EXACT), mWorkspaces(&_workspaces) {}
+
+/**************
+ * TBB Operator
+ **************/
+template<typename _Tp>
+void TiledFilteringBody<_Tp>::operator() (
+		const BlockedRange& range ) const
+{
+	Ptr<FilteringWorkspace> workspace = mWorkspaces->acquire();
+	// Tiles write disjoint parts of the features
+	Mat_<_Tp> output = dst;
+	int numFilters = mPlan->getNumFilters();
+	vector<double> taskSums((sums != 0) ? 3*numFilters : 0, 0.0);
+	int complexType = DataType<Vec<_Tp, 2> >::type;
+	int realType = DataType<_Tp>::type;
+
+	int rows = mPlan->getDFTSize().height;
+	int cols = mPlan->getDFTSize().width;
+	// The response centred on a pixel is found at its position in the tile
+	// plus the filter centre. It depends on the pixels up to half the
+	// filter size away, so the first ones of the tile are wrapped around.
+	Point centre = mPlan->getFilterCentre();
+	int marginRows = FilteringHelpers::getTileMargin(
+			mPlan->getFilterSizeX());
+	int marginCols = FilteringHelpers::getTileMargin(
+			mPlan->getFilterSizeY());
+	int validRows = rows - centre.y - marginRows;
+	int validCols = cols - centre.x - marginCols;
+
+	Mat_<_Tp> padded = workspace->getBuffer(FILTERING_WORKSPACE_PADDED, rows,
+			cols, realType);
+	Mat_<Vec<_Tp, 2> > spectrum = workspace->getBuffer(
+			FILTERING_WORKSPACE_SPECTRA, rows, cols, complexType);
+	Mat_<_Tp> realSpectrum = workspace->getBuffer(
+			FILTERING_WORKSPACE_REAL_SPECTRA, rows, cols, realType);
+	Mat_<Vec<_Tp, 2> > product = workspace->getBuffer(
+			FILTERING_WORKSPACE_PRODUCTS, rows, cols, complexType);
+	Mat_<_Tp> realProduct = workspace->getBuffer(
+			FILTERING_WORKSPACE_REAL_PRODUCTS, rows, cols, realType);
+	Mat_<_Tp> realResponse = workspace->getBuffer(
+			FILTERING_WORKSPACE_REAL_RESPONSES, rows, cols, realType);
+	FFTBackend* fft = workspace->fft;
+
+	for( int tile=range.begin(); tile<range.end( ); ++tile )
+	{
+		// Image pixels whose outputs are valid in this tile, and the
+		// output samples taken from them
+		int firstRow = (tile / mTileCols) * validRows;
+		int firstCol = (tile % mTileCols) * validCols;
+		int firstOutputRow = lower_bound(mRowSources,
+				mRowSources + mOutputRows, firstRow) - mRowSources;
+		int lastOutputRow = lower_bound(mRowSources,
+				mRowSources + mOutputRows, firstRow + validRows) - mRowSources;
+		int firstOutputCol = lower_bound(mColSources,
+				mColSources + mOutputCols, firstCol) - mColSources;
+		int lastOutputCol = lower_bound(mColSources,
+				mColSources + mOutputCols, firstCol + validCols) - mColSources;
+		if((firstOutputRow == lastOutputRow) ||
+				(firstOutputCol == lastOutputCol))
+		{
+			continue;
+		}
+
+		// The tile starts the margin before its first valid pixel, and is
+		// zero outside of the image
+		Point origin(firstCol - marginCols, firstRow - marginRows);
+		Rect area = Rect(origin.x, origin.y, cols, rows) &
+				Rect(0, 0, image.cols, image.rows);
+		((Mat)padded).setTo(Scalar::all(0));
+		Mat_<_Tp> block = padded(area - origin);
+		((Mat)image(area)).copyTo(block);
+
+		if(mPlan->hasComplexSpectra())
+		{
+			fft->dft(padded, spectrum, DFT_COMPLEX_OUTPUT);
+		}
+		if(mPlan->hasRealSpectra())
+		{
+			fft->dft(padded, realSpectrum, 0);
+		}
+
+		for(int i=0; i<numFilters; i++)
+		{
+			if(mPlan->isRealSpectrum(i))
+			{
+				mulSpectrums(realSpectrum, mPlan->getRealFilterFFT(i),
+						realProduct, 0);
+				fft->idft(realProduct, realResponse,
+						DFT_REAL_OUTPUT + DFT_SCALE);
+			}
+			else {
+				if(mPlan->hasReducedSpectra())
+				{
+					ImageHelpers::multiplyComplexSpectra(spectrum,
+							mPlan->getReducedFilterFFTPtr(i), product);
+				}
+				else {
+					ImageHelpers::multiplyComplexSpectra(spectrum,
+							mPlan->getFilterFFTPtr(i), product);
+				}
+				fft->idft(product, product, DFT_COMPLEX_OUTPUT + DFT_SCALE);
+			}
+
+			Vec<_Tp, 2> mean = (mMeans != 0) ? mMeans[i] : Vec<_Tp, 2>(0, 0);
+			_Tp scale = (mStds != 0) ? _Tp(1) / mStds[i] : _Tp(1);
+			for(int o=firstOutputRow; o<lastOutputRow; o++)
+			{
+				int row = mRowSources[o] - origin.y + centre.y;
+				_Tp* features = (sums != 0) ? 0 :
+						output[i] + o*mOutputCols;
+				for(int q=firstOutputCol; q<lastOutputCol; q++)
+				{
+					int col = mColSources[q] - origin.x + centre.x;
+					_Tp real;
+					_Tp imag = 0;
+					if(mPlan->isRealSpectrum(i))
+					{
+						real = realResponse(row, col);
+					}
+					else {
+						real = product(row, col)[0];
+						imag = product(row, col)[1];
+					}
+					if(sums != 0)
+					{
+						taskSums[3*i] += real;
+						taskSums[3*i + 1] += imag;
+						taskSums[3*i + 2] += (double)real*real +
+								(double)imag*imag;
+					}
+					else {
+						features[q] = ImageHelpers::complexMagnitude(
+								(real - mean[0])*scale,
+								(imag - mean[1])*scale, mMagnitudeMode);
+					}
+				}
+			}
+		}
+	}
+
+	if(sums != 0)
+	{
+		AutoLock lock(*sumsMutex);
+		for(size_t k=0; k<taskSums.size(); k++)
+		{
+			sums[k] += taskSums[k];
+		}
+	}
+
+	mWorkspaces->release(workspace);
+}
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                           ApplyFilterSetBody                             ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Template class for parallel filtering, by one or more plans sharing their
+ * DFT size, of images of type _Ip
+ */
+template<typename _Tp, typename _Ip = _Tp>
 class ApplyFilterSetBody
 {
 public:
@@ -72,10 +655,14 @@ public:
 	/*
 	 * Constructor
 	 */
-	ApplyFilterSetBody(int _numFilters, int _rowFilteredImageSize,
-			GaborSet<_Tp> _filterSet, bool _needZMUNormalization,
+	ApplyFilterSetBody(int _numPlans,
+			const GaborFilteringPlan<_Tp>* const* _plans,
+			bool _needZMUNormalization,
 			bool _needDownSampling, _Tp _downSamplingRatio,
-			vector<Mat_<_Tp> > _input, Mat_<_Tp> _output);
+			const _Tp* const* _downSamplingRatios, int _downSamplingMethod,
+			int _channelCombination, int _magnitudeMode,
+			const vector<Mat_<_Ip> >& _input, Mat_<_Tp>* _outputs,
+			FilteringWorkspacePool& _workspaces);
 
 	/*
 	 * TBB operator
@@ -87,18 +674,28 @@ private:
 	/*
 	 * Input and output arguments
 	 */
-	vector<Mat_<_Tp> > input;
-	Mat_<_Tp> output;
+	// Bodies are copied by every split, so the images are not
+	const vector<Mat_<_Ip> >* input;
+	// One feature matrix per plan
+	Mat_<_Tp>* outputs;
 
 	/*
 	 * Arguments needed for computation
 	 */
-	int mNumFilters;
-	int mRowFilteredImageSize;
-	GaborSet<_Tp> mFilterSet;
+	int mNumPlans;
+	// Bodies only live during parallel_for, the plans outlive them
+	const GaborFilteringPlan<_Tp>* const* mPlans;
+	bool mHasComplexSpectra;
+	bool mHasRealSpectra;
 	bool mNeedZMUNormalization;
 	bool mNeedDownSampling;
 	_Tp mDownSamplingRatio;
+	// Ratios of the filters of each plan, or null
+	const _Tp* const* mDownSamplingRatios;
+	int mDownSamplingMethod;
+	int mChannelCombination;
+	int mMagnitudeMode;
+	FilteringWorkspacePool* mWorkspaces;
 };
 
 /******************************************************************************
@@ -110,112 +707,842 @@ private:
 /*************
  * Constructor
  *************/
-template<typename _Tp>
-ApplyFilterSetBody<_Tp>::ApplyFilterSetBody(int _numFilters,
-		int _rowFilteredImageSize,	GaborSet<_Tp> _filterSet,
+template<typename _Tp, typename _Ip>
+ApplyFilterSetBody<_Tp, _Ip>::ApplyFilterSetBody(int _numPlans,
+		const GaborFilteringPlan<_Tp>* const* _plans,
 		bool _needZMUNormalization,	bool _needDownSampling,
-		_Tp _downSamplingRatio,	vector<Mat_<_Tp> > _input, Mat_<_Tp> _output) :
-		mNumFilters(_numFilters), mRowFilteredImageSize(_rowFilteredImageSize),
-		mFilterSet(_filterSet), mNeedZMUNormalization(_needZMUNormalization),
+		_Tp _downSamplingRatio, const _Tp* const* _downSamplingRatios,
+		int _downSamplingMethod, int _channelCombination,
+		int _magnitudeMode, const vector<Mat_<_Ip> >& _input,
+		Mat_<_Tp>* _outputs, FilteringWorkspacePool& _workspaces) :
+		input(&_input), outputs(_outputs), mNumPlans(_numPlans),
+		mPlans(_plans), mHasComplexSpectra(false), mHasRealSpectra(false),
+		mNeedZMUNormalization(_needZMUNormalization),
 		mNeedDownSampling(_needDownSampling),
-		mDownSamplingRatio(_downSamplingRatio), input(_input),
-		output(_output) {}
+		mDownSamplingRatio(_downSamplingRatio),
+		mDownSamplingRatios(_downSamplingRatios),
+		mDownSamplingMethod(_downSamplingMethod),
+		mChannelCombination(_channelCombination),
+		mMagnitudeMode(_magnitudeMode), mWorkspaces(&_workspaces)
+{
+	for(int p=0; p<mNumPlans; p++)
+	{
+		CV_Assert(mPlans[p]->getDFTSize() == mPlans[0]->getDFTSize());
+		mHasComplexSpectra |= mPlans[p]->hasComplexSpectra();
+		mHasRealSpectra |= mPlans[p]->hasRealSpectra();
+	}
+}
 
 /**************
  * TBB Operator
  **************/
-template<typename _Tp>
-void ApplyFilterSetBody<_Tp>::operator() (
+template<typename _Tp, typename _Ip>
+void ApplyFilterSetBody<_Tp, _Ip>::operator() (
 		const BlockedRange& range ) const
 {
-	Mat_<double> tmpResult;
+	// The workspace of the task is kept for its whole range
+	Ptr<FilteringWorkspace> workspace = mWorkspaces->acquire();
+	Mat_<_Tp> padded;
+	Mat_<Vec<_Tp, 2> > spectra;
+	Mat_<_Tp> realSpectra;
+	Size dftSize = mPlans[0]->getDFTSize();
+	int rows = dftSize.height;
+	int cols = dftSize.width;
+	int cn = DataType<_Ip>::channels;
+	bool concatenate = (mChannelCombination == CHANNELS_CONCATENATE);
 
-	for( int index=range.begin(); index!=range.end( ); ++index )
+	// The spectra of the images are computed in batches, with one spectrum
+	// per channel
+	for( int first=range.begin(); first<range.end( );
+			first+=FILTERING_BATCH_IMAGES )
 	{
-		FilteringHelpers::imageApplyGaborSet(input[index] , mFilterSet,
-			   tmpResult, mNeedZMUNormalization,
-			   mNeedDownSampling, mDownSamplingRatio);
+		int count = min(FILTERING_BATCH_IMAGES, range.end() - first);
+		padded = workspace->getBuffer(FILTERING_WORKSPACE_PADDED,
+				count*cn*rows, cols, DataType<_Tp>::type);
+		if(mHasComplexSpectra)
+		{
+			spectra = workspace->getBuffer(FILTERING_WORKSPACE_SPECTRA,
+					count*cn*rows, cols, DataType<Vec<_Tp, 2> >::type);
+			ImageHelpers::complexDFT(&(*input)[first], count, spectra,
+					dftSize, padded, *workspace->fft);
+		}
+		if(mHasRealSpectra)
+		{
+			realSpectra = workspace->getBuffer(
+					FILTERING_WORKSPACE_REAL_SPECTRA, count*cn*rows, cols,
+					DataType<_Tp>::type);
+			ImageHelpers::realDFT(&(*input)[first], count, realSpectra,
+					dftSize, padded, *workspace->fft);
+		}
 
-	   Mat_<_Tp> tmp = output.row(index);
+		for( int k=0; k<count*cn; ++k )
+		{
+			int image = first + k/cn;
+			int channel = k % cn;
+			Mat_<Vec<_Tp, 2> > imageFFT;
+			Mat_<_Tp> imageCCS;
+			if(!spectra.empty())
+			{
+				imageFFT = spectra.rowRange(k*rows, (k + 1)*rows);
+			}
+			if(!realSpectra.empty())
+			{
+				imageCCS = realSpectra.rowRange(k*rows, (k + 1)*rows);
+			}
 
-	   ((Mat)tmpResult.reshape(1)).copyTo(tmp);
+			// Responses are written in place into the row of the image,
+			// every plan filtering the same spectra. Concatenated channels
+			// have their own rows of features, the others are combined
+			// with those of the first channel. Filters with ratios of
+			// their own are written in a single row.
+			for(int p=0; p<mNumPlans; p++)
+			{
+				const _Tp* ratios = (mDownSamplingRatios != 0) ?
+						mDownSamplingRatios[p] : 0;
+				int numRows = (ratios != 0) ? 1 :
+						mPlans[p]->getNumFilters();
+				Mat_<_Tp> features = ((Mat)outputs[p].row(image)).reshape(
+						1, concatenate ? cn*numRows : numRows);
+				if(concatenate)
+				{
+					features = features.rowRange(channel*numRows,
+							(channel + 1)*numRows);
+				}
+				uchar* data = ((Mat)features).data;
+				FilteringHelpers::imageApplyGaborSet((*input)[image],
+						imageFFT, imageCCS, *mPlans[p], features, *workspace,
+						mNeedZMUNormalization, mNeedDownSampling,
+						mDownSamplingRatio, mDownSamplingMethod, channel,
+						(channel == 0) ? (int)CHANNELS_CONCATENATE :
+						mChannelCombination, mMagnitudeMode, ratios);
+
+				CV_Assert(((Mat)features).data == data);
+			}
+		}
 	}
 
+	mWorkspaces->release(workspace);
 }
 
-template<typename _Tp>
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyGaborSetToMatVector(
+        vector<Mat_<_Ip> >& mat, const FilterBank<_Tp>& filterBank,
+        Mat_<_Tp>& features, bool needZMUNormalization,
+        bool needDownSampling, _Tp downSamplingRatio, int downSamplingMethod,
+        int channelCombination, int magnitudeMode)
+{
+    GaborFilteringPlan<_Tp> plan(filterBank, ((Mat)mat.front()).size(),
+            FILTERING_FFT, false, getPlanDownSamplingStep(needDownSampling,
+            downSamplingRatio, downSamplingMethod));
+
+    imageApplyGaborSetToMatVector(mat, plan, features, needZMUNormalization,
+            needDownSampling, downSamplingRatio, downSamplingMethod,
+            channelCombination, magnitudeMode);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyGaborSetToMatVector(
+        vector<Mat_<_Ip> >& mat, const GaborFilteringPlan<_Tp>& plan,
+        Mat_<_Tp>& features, bool needZMUNormalization,
+        bool needDownSampling, _Tp downSamplingRatio, int downSamplingMethod,
+        int channelCombination, int magnitudeMode,
+        FilteringWorkspacePool* workspaces)
+{
+    const GaborFilteringPlan<_Tp>* plans[] = {&plan};
+
+    applyFilterSets(mat, 1, plans, &features, needZMUNormalization,
+            needDownSampling, downSamplingRatio, (const _Tp* const*)0,
+            downSamplingMethod, channelCombination, magnitudeMode,
+            workspaces);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyFilterBanksToMatVector(
+        vector<Mat_<_Ip> >& mat,
+        const vector<const FilterBank<_Tp>*>& filterBanks,
+        vector<Mat_<_Tp> >& features, bool needZMUNormalization,
+        bool needDownSampling, _Tp downSamplingRatio, int downSamplingMethod,
+        int channelCombination, int magnitudeMode)
+{
+    int step = getPlanDownSamplingStep(needDownSampling, downSamplingRatio,
+            downSamplingMethod);
+    Size imageSize = ((Mat)mat.front()).size();
+
+    // Common DFT size: the largest one of the banks. Banks of filters of the
+    // image size get padded at a larger size, which can grow it again.
+    Size minDFTSize;
+    Size dftSize;
+    do
+    {
+        dftSize = minDFTSize;
+        for(size_t b=0; b<filterBanks.size(); b++)
+        {
+            Size size = GaborFilteringPlan<_Tp>::computeDFTSize(
+                    *filterBanks[b], imageSize, step, dftSize);
+            minDFTSize.width = max(minDFTSize.width, size.width);
+            minDFTSize.height = max(minDFTSize.height, size.height);
+        }
+    } while(minDFTSize != dftSize);
+
+    vector<GaborFilteringPlan<_Tp> > plans(filterBanks.size());
+    vector<const GaborFilteringPlan<_Tp>*> planPtrs(filterBanks.size());
+    for(size_t b=0; b<filterBanks.size(); b++)
+    {
+        plans[b] = GaborFilteringPlan<_Tp>(*filterBanks[b], imageSize,
+                FILTERING_FFT, false, step, minDFTSize);
+        planPtrs[b] = &plans[b];
+    }
+
+    imageApplyFilterBanksToMatVector(mat, planPtrs, features,
+            needZMUNormalization, needDownSampling, downSamplingRatio,
+            downSamplingMethod, channelCombination, magnitudeMode);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyFilterBanksToMatVector(
+        vector<Mat_<_Ip> >& mat,
+        const vector<const GaborFilteringPlan<_Tp>*>& plans,
+        vector<Mat_<_Tp> >& features, bool needZMUNormalization,
+        bool needDownSampling, _Tp downSamplingRatio, int downSamplingMethod,
+        int channelCombination, int magnitudeMode,
+        FilteringWorkspacePool* workspaces)
+{
+    CV_Assert(!plans.empty());
+
+    features.resize(plans.size());
+    applyFilterSets(mat, plans.size(), &plans.front(), &features.front(),
+            needZMUNormalization, needDownSampling, downSamplingRatio,
+            (const _Tp* const*)0, downSamplingMethod, channelCombination,
+            magnitudeMode, workspaces);
+}
+
+template<typename _Tp, typename _Ip>
 void FilteringHelpers::imageApplyGaborSetToMatVector(
-        vector<Mat_<_Tp> >& mat, const GaborSet<_Tp> filterSet,
+        vector<Mat_<_Ip> >& mat, const FilterBank<_Tp>& filterBank,
         Mat_<_Tp>& features, bool needZMUNormalization,
-        bool needDownSampling, _Tp downSamplingRatio)
+        const vector<_Tp>& downSamplingRatios, int downSamplingMethod,
+        int channelCombination, int magnitudeMode)
 {
+    GaborFilteringPlan<_Tp> plan(filterBank, ((Mat)mat.front()).size(),
+            FILTERING_FFT);
 
-    int numFilters = filterSet.getScales() * filterSet.getOrientations();
+    imageApplyGaborSetToMatVector(mat, plan, features, needZMUNormalization,
+            downSamplingRatios, downSamplingMethod, channelCombination,
+            magnitudeMode);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyGaborSetToMatVector(
+        vector<Mat_<_Ip> >& mat, const GaborFilteringPlan<_Tp>& plan,
+        Mat_<_Tp>& features, bool needZMUNormalization,
+        const vector<_Tp>& downSamplingRatios, int downSamplingMethod,
+        int channelCombination, int magnitudeMode,
+        FilteringWorkspacePool* workspaces)
+{
+    CV_Assert((int)downSamplingRatios.size() == plan.getNumFilters());
+
+    const GaborFilteringPlan<_Tp>* plans[] = {&plan};
+    const _Tp* ratios[] = {&downSamplingRatios.front()};
+
+    applyFilterSets(mat, 1, plans, &features, needZMUNormalization, true,
+            _Tp(1), ratios, downSamplingMethod, channelCombination,
+            magnitudeMode, workspaces);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyFilterBanksToMatVector(
+        vector<Mat_<_Ip> >& mat,
+        const vector<const GaborFilteringPlan<_Tp>*>& plans,
+        vector<Mat_<_Tp> >& features, bool needZMUNormalization,
+        const vector<vector<_Tp> >& downSamplingRatios,
+        int downSamplingMethod, int channelCombination, int magnitudeMode,
+        FilteringWorkspacePool* workspaces)
+{
+    CV_Assert(!plans.empty() && (downSamplingRatios.size() == plans.size()));
 
+    vector<const _Tp*> ratios(plans.size());
+    for(size_t p=0; p<plans.size(); p++)
+    {
+        CV_Assert((int)downSamplingRatios[p].size() ==
+                plans[p]->getNumFilters());
+        ratios[p] = &downSamplingRatios[p].front();
+    }
+
+    features.resize(plans.size());
+    applyFilterSets(mat, plans.size(), &plans.front(), &features.front(),
+            needZMUNormalization, true, _Tp(1), &ratios.front(),
+            downSamplingMethod, channelCombination, magnitudeMode,
+            workspaces);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::applyFilterSets(vector<Mat_<_Ip> >& mat,
+        int numPlans, const GaborFilteringPlan<_Tp>* const* plans,
+        Mat_<_Tp>* features, bool needZMUNormalization,
+        bool needDownSampling, _Tp downSamplingRatio,
+        const _Tp* const* ratios, int downSamplingMethod,
+        int channelCombination, int magnitudeMode,
+        FilteringWorkspacePool* workspaces)
+{
     int numImages = mat.size();
+    Size imageSize = ((Mat)mat.front()).size();
+    int channels = 1;
+    if(channelCombination == CHANNELS_CONCATENATE)
+    {
+        channels = DataType<_Ip>::channels;
+    }
 
-    int rowFilteredImageSize = ((Mat)mat.front()).cols *
-           ((Mat)mat.front()).rows * numFilters *
-           pow(downSamplingRatio,2);
+    for(int p=0; p<numPlans; p++)
+    {
+        int rowFilteredImageSize = 0;
+        if((ratios != 0) && (ratios[p] != 0))
+        {
+            for(int i=0; i<plans[p]->getNumFilters(); i++)
+            {
+                rowFilteredImageSize += getFilteredImageSize(imageSize,
+                        ratios[p][i]);
+            }
+        }
+        else {
+            rowFilteredImageSize = plans[p]->getNumFilters() *
+                    getFilteredImageSize(imageSize,
+                    needDownSampling ? downSamplingRatio : 1);
+        }
+        features[p].create(numImages, channels*rowFilteredImageSize);
+    }
 
-    features.create(numImages, rowFilteredImageSize);
+    FilteringWorkspacePool callWorkspaces;
+    if(workspaces == 0)
+    {
+        workspaces = &callWorkspaces;
+    }
 
-    ApplyFilterSetBody<_Tp> applyFilterSetBody(numFilters,
-    		rowFilteredImageSize, filterSet, needZMUNormalization,
-    		needDownSampling, downSamplingRatio, mat, features);
+    ApplyFilterSetBody<_Tp, _Ip> applyFilterSetBody(numPlans, plans,
+    		needZMUNormalization, needDownSampling, downSamplingRatio, ratios,
+    		downSamplingMethod, channelCombination, magnitudeMode, mat,
+    		features, *workspaces);
 
     parallel_for(BlockedRange(0, numImages), applyFilterSetBody);
 }
 
+template<typename _Tp>
+void FilteringHelpers::getDownSamplingRatios(
+        const FilterBank<_Tp>& filterBank, vector<_Tp>& ratios)
+{
+    ratios.resize(filterBank.getNumFilters());
+    for(size_t i=0; i<ratios.size(); i++)
+    {
+        // A step of n pixels keeps the frequencies up to pi/n
+        double bandwidth = filterBank.getBandwidth(i);
+        int step = (bandwidth > 0) ? max(1, cvFloor(M_PI/bandwidth)) : 1;
+        ratios[i] = (_Tp)(1.0/step);
+    }
+}
+
+template<typename _Tp>
+void FilteringHelpers::imageApplyGaborSet(Mat_<_Tp> image,
+        const FilterBank<_Tp>& filterBank, Mat_<_Tp>& dst,
+        bool needZMUNorm, bool needDownSampl, _Tp ratio,
+        int downSamplingMethod, int magnitudeMode)
+{
+    GaborFilteringPlan<_Tp> plan(filterBank, ((Mat)image).size(),
+            FILTERING_FFT, false, getPlanDownSamplingStep(needDownSampl,
+            ratio, downSamplingMethod));
+
+    imageApplyGaborSet(image, plan, dst, needZMUNorm, needDownSampl, ratio,
+            downSamplingMethod, magnitudeMode);
+}
+
 template<typename _Tp>
 void FilteringHelpers::imageApplyGaborSet(Mat_<_Tp> image,
-        GaborSet<_Tp> filterSet, Mat_<_Tp>& dst,
-        bool needZMUNorm, bool needDownSampl, _Tp ratio)
+        const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+        bool needZMUNorm, bool needDownSampl, _Tp ratio,
+        int downSamplingMethod, int magnitudeMode)
 {
+    FilteringWorkspace workspace;
 
-    GaborFilter<_Tp>* filters = filterSet.getGaborSet();
+    imageApplyGaborSet(image, plan, dst, workspace, needZMUNorm,
+            needDownSampl, ratio, downSamplingMethod, magnitudeMode);
+}
 
-    int numFilters = filterSet.getScales() * filterSet.getOrientations();
-    int rowFilteredImageSize = (((Mat)image).rows)*
-            (((Mat)image).cols);
-    if(needDownSampl)
+template<typename _Tp>
+void FilteringHelpers::imageApplyGaborSet(Mat_<_Tp> image,
+        const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+        FilteringWorkspace& workspace, bool needZMUNorm, bool needDownSampl,
+        _Tp ratio, int downSamplingMethod, int magnitudeMode)
+{
+    int rows = plan.getDFTSize().height;
+    int cols = plan.getDFTSize().width;
+
+    // Filters convolved in the spatial domain don't need the image spectrum,
+    // and real kernels only need its half
+    Mat_<_Tp> padded = workspace.getBuffer(FILTERING_WORKSPACE_PADDED, rows,
+            cols, DataType<_Tp>::type);
+    Mat_<Vec<_Tp, 2> > imageFFT;
+    Mat_<_Tp> imageCCS;
+    if(plan.hasComplexSpectra())
     {
-        rowFilteredImageSize *= pow(ratio,2);
+        imageFFT = workspace.getBuffer(FILTERING_WORKSPACE_SPECTRA, rows,
+                cols, DataType<Vec<_Tp, 2> >::type);
+        ImageHelpers::complexDFT(&image, 1, imageFFT, plan.getDFTSize(),
+                padded, *workspace.fft);
+    }
+    if(plan.hasRealSpectra())
+    {
+        imageCCS = workspace.getBuffer(FILTERING_WORKSPACE_REAL_SPECTRA,
+                rows, cols, DataType<_Tp>::type);
+        ImageHelpers::realDFT(&image, 1, imageCCS, plan.getDFTSize(),
+                padded, *workspace.fft);
     }
 
-    dst.create(numFilters, rowFilteredImageSize);
+    imageApplyGaborSet(image, imageFFT, imageCCS, plan, dst, workspace,
+            needZMUNorm, needDownSampl, ratio, downSamplingMethod, 0,
+            CHANNELS_CONCATENATE, magnitudeMode);
+}
+
+template<typename _Tp>
+void FilteringHelpers::imageApplyGaborSet(Mat_<_Tp> image,
+        Mat_<Vec<_Tp, 2> > imageFFT, Mat_<_Tp> imageCCS,
+        const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+        bool needZMUNorm, bool needDownSampl, _Tp ratio,
+        int downSamplingMethod, int magnitudeMode)
+{
+    FilteringWorkspace workspace;
+
+    imageApplyGaborSet(image, imageFFT, imageCCS, plan, dst, workspace,
+            needZMUNorm, needDownSampl, ratio, downSamplingMethod, 0,
+            CHANNELS_CONCATENATE, magnitudeMode);
+}
+
+template<typename _Tp, typename _Ip>
+void FilteringHelpers::imageApplyGaborSet(Mat_<_Ip> image,
+        Mat_<Vec<_Tp, 2> > imageFFT, Mat_<_Tp> imageCCS,
+        const GaborFilteringPlan<_Tp>& plan, Mat_<_Tp>& dst,
+        FilteringWorkspace& workspace, bool needZMUNorm, bool needDownSampl,
+        _Tp ratio, int downSamplingMethod, int channel,
+        int channelCombination, int magnitudeMode, const _Tp* ratios)
+{
+    CV_Assert(((Mat)image).size() == plan.getImageSize());
+
+    int numFilters = plan.getNumFilters();
+    int rowFilteredImageSize = getFilteredImageSize(((Mat)image).size(),
+            needDownSampl ? ratio : 1);
+
+    // Filters with ratios of their own have outputs of different sizes,
+    // written one after the other in a single row
+    int dstRows = numFilters;
+    if(ratios != 0)
+    {
+        CV_Assert(needDownSampl);
+        dstRows = 1;
+        rowFilteredImageSize = 0;
+        for(int i=0; i<numFilters; i++)
+        {
+            rowFilteredImageSize += getFilteredImageSize(
+                    ((Mat)image).size(), ratios[i]);
+        }
+    }
+
+    // Combined magnitudes are accumulated into the ones already there
+    CV_Assert((channelCombination == CHANNELS_CONCATENATE) ||
+            ((dst.rows == dstRows) && (dst.cols == rowFilteredImageSize)));
+    dst.create(dstRows, rowFilteredImageSize);
+
+    // Responses of the image pixels start at the filter centre of the
+    // inverse transforms, unless the whole transforms are the responses
+    Rect imageArea = plan.getResponseArea();
+    bool needCrop = (plan.getDFTSize() != imageArea.size());
+    int rows = plan.getDFTSize().height;
+    int cols = plan.getDFTSize().width;
+
+    // Pooled responses are kept at full size, and only reduced with their
+    // magnitudes
+    int pooling = POOLING_NONE;
+    if(needDownSampl &&
+            ((downSamplingMethod == DOWNSAMPLING_AVERAGE_POOLING) ||
+            (downSamplingMethod == DOWNSAMPLING_MAX_POOLING)))
+    {
+        pooling = (downSamplingMethod == DOWNSAMPLING_MAX_POOLING) ?
+                POOLING_MAX : POOLING_AVERAGE;
+    }
+
+    // Complex responses downsampled in the frequency domain are inverse
+    // transformed at the reduced size. Ratios per filter would need a size
+    // per filter, so they are applied in the spatial domain instead.
+    int step = 0;
+    if(needDownSampl && (ratios == 0) &&
+            ((downSamplingMethod == DOWNSAMPLING_FOLD) ||
+            (downSamplingMethod == DOWNSAMPLING_CROP)))
+    {
+        step = getDownSamplingStep(ratio);
+        bool divides = (step > 1) && (rows % step == 0) &&
+                (cols % step == 0) && (imageArea.x % step == 0) &&
+                (imageArea.y % step == 0);
+        CV_Assert(divides || (downSamplingMethod == DOWNSAMPLING_FOLD));
+        if(!divides)
+        {
+            step = 0;
+        }
+    }
+    int responseRows = (step > 0) ? rows/step : rows;
+    int responseCols = (step > 0) ? cols/step : cols;
+    Rect responseArea = imageArea;
+    if(step > 0)
+    {
+        // Size of ImageHelpers::downSample output, from the reduced
+        // position of the first pixel
+        responseArea = Rect(imageArea.x/step, imageArea.y/step,
+                cvRound(imageArea.width*ratio),
+                cvRound(imageArea.height*ratio));
+    }
+
+    // Spectrum products of the FFT filters, stacked one below the other and
+    // inverse transformed in one batch. Spectra are read in place from the
+    // plan buffer.
+    vector<int>& slots = workspace.slots;
+    slots.assign(numFilters, -1);
+    int numComplex = 0;
+    int numReal = 0;
+    for(int i=0; i<numFilters; i++)
+    {
+        if(plan.getBackend(i) == FILTERING_FFT)
+        {
+            slots[i] = plan.isRealSpectrum(i) ? numReal++ : numComplex++;
+        }
+    }
+
+    // Complex responses that are whole inverse transforms take their
+    // normalization statistics from the product spectra
+    bool statsFromSpectrum = needZMUNorm && ((step > 0) ?
+            (responseArea.size() == Size(responseCols, responseRows)) :
+            (!needCrop && (!needDownSampl || (pooling != POOLING_NONE))));
+
+    // Buffers come with their final size, so the helpers filling them
+    // write in place
+    int complexType = DataType<Vec<_Tp, 2> >::type;
+    int realType = DataType<_Tp>::type;
+    Mat_<Vec<_Tp, 2> > products;
+    Mat_<Vec<_Tp, 2> > responses;
+    Mat_<_Tp> realResponses;
+    if(numComplex > 0)
+    {
+        products = workspace.getBuffer(FILTERING_WORKSPACE_PRODUCTS,
+                numComplex*responseRows, responseCols, complexType);
+        responses = workspace.getBuffer(FILTERING_WORKSPACE_RESPONSES,
+                numComplex*responseRows, responseCols, complexType);
+        if(step > 0)
+        {
+            // Products downsampled in the frequency domain are reduced one
+            // by one, from a full size product
+            Mat_<Vec<_Tp, 2> > fullProduct = workspace.getBuffer(
+                    FILTERING_WORKSPACE_FULL_PRODUCT, rows, cols,
+                    complexType);
+            for(int i=0; i<numFilters; i++)
+            {
+                if((slots[i] < 0) || plan.isRealSpectrum(i))
+                {
+                    continue;
+                }
+                Mat_<Vec<_Tp, 2> > product = products.rowRange(
+                        slots[i]*responseRows, (slots[i] + 1)*responseRows);
+                if(plan.hasReducedSpectra())
+                {
+                    ImageHelpers::multiplyComplexSpectra(imageFFT,
+                            plan.getReducedFilterFFTPtr(i), fullProduct);
+                }
+                else {
+                    ImageHelpers::multiplyComplexSpectra(imageFFT,
+                            plan.getFilterFFTPtr(i), fullProduct);
+                }
+                if(downSamplingMethod == DOWNSAMPLING_CROP)
+                {
+                    ImageHelpers::cropSpectrum(fullProduct, product, step);
+                }
+                else {
+                    ImageHelpers::foldSpectrum(fullProduct, product, step);
+                }
+            }
+        }
+        else if(plan.hasReducedSpectra())
+        {
+            // Every product in one sweep over the image spectrum
+            AutoBuffer<const Vec2f*> filters(numComplex);
+            for(int i=0; i<numFilters; i++)
+            {
+                if((slots[i] >= 0) && !plan.isRealSpectrum(i))
+                {
+                    filters[slots[i]] = plan.getReducedFilterFFTPtr(i);
+                }
+            }
+            ImageHelpers::multiplyComplexSpectra(imageFFT,
+                    (const Vec2f* const*)filters, numComplex, products);
+        }
+        else {
+            AutoBuffer<const Vec<_Tp, 2>*> filters(numComplex);
+            for(int i=0; i<numFilters; i++)
+            {
+                if((slots[i] >= 0) && !plan.isRealSpectrum(i))
+                {
+                    filters[slots[i]] = plan.getFilterFFTPtr(i);
+                }
+            }
+            ImageHelpers::multiplyComplexSpectra(imageFFT,
+                    (const Vec<_Tp, 2>* const*)filters, numComplex,
+                    products);
+        }
+        workspace.fft->idftBatch(products, responses, numComplex,
+                DFT_COMPLEX_OUTPUT + DFT_SCALE);
+    }
+    if(numReal > 0)
+    {
+        Mat_<_Tp> products = workspace.getBuffer(
+                FILTERING_WORKSPACE_REAL_PRODUCTS, numReal*rows, cols,
+                realType);
+        realResponses = workspace.getBuffer(
+                FILTERING_WORKSPACE_REAL_RESPONSES, numReal*rows, cols,
+                realType);
+        for(int i=0; i<numFilters; i++)
+        {
+            if((slots[i] < 0) || !plan.isRealSpectrum(i))
+            {
+                continue;
+            }
+            Mat_<_Tp> product = products.rowRange(slots[i]*rows,
+                    (slots[i] + 1)*rows);
+            mulSpectrums(imageCCS, plan.getRealFilterFFT(i), product, 0);
+        }
+        workspace.fft->idftBatch(products, realResponses, numReal,
+                DFT_REAL_OUTPUT + DFT_SCALE);
+    }
+
+    // Filters convolved in the spatial domain work on the image itself,
+    // or on its channel converted to _Tp once if it has another type
+    Mat_<_Tp> spatialImage;
+    if(numComplex + numReal < numFilters)
+    {
+        if(((Mat)image).type() == realType)
+        {
+            spatialImage = (Mat)image;
+        }
+        else {
+            spatialImage = workspace.getBuffer(FILTERING_WORKSPACE_IMAGE,
+                    imageArea.height, imageArea.width, realType);
+            ImageHelpers::convertChannel(image, channel, spatialImage);
+        }
+    }
 
-    GaborFilter<_Tp> filter;
-    Mat_<Vec<_Tp, 2> > imageFFT;
-    ImageHelpers::complexDFT(image, imageFFT);
-    Mat_<Vec<_Tp, 2> > fFFT;
     Mat_<Vec<_Tp, 2> > tmpResult;
-    Mat_<Vec<_Tp, 2> > normalizedImage;
-    Mat_<_Tp> features;
+    Mat_<Vec<_Tp, 2> > downSampled;
+    int offset = 0;
     for(int i=0; i< numFilters; i++)
     {
-        filter = filters[i];
-        fFFT = filter.getFilterFFT();
-        ImageHelpers::convolutionComplexFilter(imageFFT, fFFT, tmpResult);
-        if(needDownSampl)
+        _Tp filterRatio = (ratios != 0) ? ratios[i] : ratio;
+        int poolingStep = 1;
+        if(pooling != POOLING_NONE)
+        {
+            poolingStep = getDownSamplingStep(filterRatio);
+            CV_Assert(poolingStep > 0);
+        }
+
+        if(plan.getBackend(i) != FILTERING_FFT)
+        {
+            tmpResult = workspace.getBuffer(FILTERING_WORKSPACE_RESPONSE,
+                    imageArea.height, imageArea.width, complexType);
+        }
+        // Spatial responses and their scratch images are all in the
+        // workspace
+        if(plan.getBackend(i) == FILTERING_DIRECT)
         {
-            ImageHelpers::downSample(tmpResult, tmpResult, ratio);
+            Mat_<_Tp> term = workspace.getBuffer(FILTERING_WORKSPACE_TERM,
+                    imageArea.height, imageArea.width, realType);
+            ImageHelpers::convolutionSeparable(spatialImage,
+                    plan.getSeparableKernel(i), tmpResult, term);
         }
-        if(needZMUNorm)
+        else if(plan.getBackend(i) == FILTERING_RECURSIVE)
         {
-            ImageHelpers::zmuNormalization(tmpResult, normalizedImage);
-            ImageHelpers::magnitudeComplexImage(normalizedImage, features);
+            const RecursiveGaborKernel& kernel = plan.getRecursiveKernel(i);
+            Size paddedSize = ImageHelpers::getRecursivePaddedSize(
+                    imageArea.size(), kernel);
+            Mat_<_Tp> padded = workspace.getBuffer(
+                    FILTERING_WORKSPACE_RECURSIVE_PADDED, paddedSize.height,
+                    paddedSize.width, realType);
+            Mat_<Vec<_Tp, 2> > demodulated = workspace.getBuffer(
+                    FILTERING_WORKSPACE_DEMODULATED, paddedSize.height,
+                    paddedSize.width, complexType);
+            ImageHelpers::convolutionRecursiveGabor(spatialImage, kernel,
+                    tmpResult, padded, demodulated);
         }
         else {
-            ImageHelpers::magnitudeComplexImage(tmpResult, features);
+            if(plan.isRealSpectrum(i))
+            {
+                // Responses of real kernels are real
+                tmpResult = workspace.getBuffer(FILTERING_WORKSPACE_RESPONSE,
+                        rows, cols, complexType);
+                for(int r=0; r<rows; r++)
+                {
+                    const _Tp* src = realResponses[slots[i]*rows + r];
+                    Vec<_Tp, 2>* row = tmpResult[r];
+                    for(int c=0; c<cols; c++)
+                    {
+                        row[c] = Vec<_Tp, 2>(src[c], 0);
+                    }
+                }
+            }
+            else {
+                tmpResult = responses.rowRange(slots[i]*responseRows,
+                        (slots[i] + 1)*responseRows);
+                if(step > 0)
+                {
+                    // Already downsampled, only the padding is left
+                    tmpResult = tmpResult(responseArea);
+                }
+            }
+            if(needCrop && ((step == 0) || plan.isRealSpectrum(i)))
+            {
+                // Keep the responses of the image pixels only
+                tmpResult = tmpResult(imageArea);
+            }
         }
-        Mat_<_Tp> tmp = dst.row(i);
+        if(needDownSampl && (pooling == POOLING_NONE) && ((step == 0) ||
+                (slots[i] < 0) || plan.isRealSpectrum(i)))
+        {
+            downSampled = workspace.getBuffer(FILTERING_WORKSPACE_DOWNSAMPLED,
+                    cvRound(((Mat)tmpResult).rows*filterRatio),
+                    cvRound(((Mat)tmpResult).cols*filterRatio), complexType);
+            ImageHelpers::downSample(tmpResult, downSampled, filterRatio);
+            tmpResult = downSampled;
+        }
+        int filterSize = ImageHelpers::getPooledSize(((Mat)tmpResult).rows,
+                poolingStep)*ImageHelpers::getPooledSize(
+                ((Mat)tmpResult).cols, poolingStep);
+        CV_Assert((ratios != 0) || (filterSize == dst.cols));
+        CV_Assert(offset + filterSize <= dst.cols);
+        _Tp* out = (ratios != 0) ? dst[0] + offset : dst[i];
+        offset += filterSize;
+
+        // Normalized magnitudes are written straight to the feature row
+        if(statsFromSpectrum && (slots[i] >= 0) && !plan.isRealSpectrum(i))
+        {
+            Mat_<Vec<_Tp, 2> > product = products.rowRange(
+                    slots[i]*responseRows, (slots[i] + 1)*responseRows);
+            Vec<_Tp, 2> mean;
+            _Tp std;
+            ImageHelpers::spectrumStdMean(product, mean, std);
+            ImageHelpers::zmuMagnitude(tmpResult, out, mean, std,
+                    channelCombination, magnitudeMode, pooling, poolingStep);
+        }
+        else {
+            ImageHelpers::zmuMagnitude(tmpResult, out, needZMUNorm,
+                    channelCombination, magnitudeMode, pooling, poolingStep);
+        }
+    }
+
+}
+
+
+template<typename _Tp>
+void FilteringHelpers::imageApplyGaborSetTiled(Mat_<_Tp> image,
+        const FilterBank<_Tp>& filterBank, Mat_<_Tp>& dst,
+        bool needZMUNorm, bool needDownSampl, _Tp ratio,
+        int magnitudeMode)
+{
+    GaborFilteringPlan<_Tp> tilePlan(filterBank, getTileSize(filterBank));
+
+    imageApplyGaborSetTiled(image, tilePlan, dst, needZMUNorm,
+            needDownSampl, ratio, magnitudeMode);
+}
+
+template<typename _Tp>
+void FilteringHelpers::imageApplyGaborSetTiled(Mat_<_Tp> image,
+        const GaborFilteringPlan<_Tp>& tilePlan, Mat_<_Tp>& dst,
+        bool needZMUNorm, bool needDownSampl, _Tp ratio,
+        int magnitudeMode)
+{
+    CV_Assert(!tilePlan.hasBackend(FILTERING_DIRECT) &&
+            !tilePlan.hasBackend(FILTERING_RECURSIVE));
 
-        ((Mat)features.reshape(1)).copyTo(tmp);
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
+    Point centre = tilePlan.getFilterCentre();
+    int validRows = tilePlan.getDFTSize().height - centre.y -
+            getTileMargin(tilePlan.getFilterSizeX());
+    int validCols = tilePlan.getDFTSize().width - centre.x -
+            getTileMargin(tilePlan.getFilterSizeY());
+    CV_Assert((validRows > 0) && (validCols > 0));
+
+    // Pixel each output sample is taken from, as resize with INTER_NEAREST
+    // picks it
+    double scale = needDownSampl ? 1.0/ratio : 1.0;
+    vector<int> rowSources(needDownSampl ? cvRound(rows*ratio) : rows);
+    vector<int> colSources(needDownSampl ? cvRound(cols*ratio) : cols);
+    CV_Assert(!rowSources.empty() && !colSources.empty());
+    for(size_t i=0; i<rowSources.size(); i++)
+    {
+        rowSources[i] = min(cvFloor(i*scale), rows - 1);
     }
+    for(size_t j=0; j<colSources.size(); j++)
+    {
+        colSources[j] = min(cvFloor(j*scale), cols - 1);
+    }
+
+    int numFilters = tilePlan.getNumFilters();
+    int outputRows = rowSources.size();
+    int outputCols = colSources.size();
+    int tileRows = (rows + validRows - 1) / validRows;
+    int tileCols = (cols + validCols - 1) / validCols;
+
+    FilteringWorkspacePool workspaces;
+
+    // Normalization needs the statistics of whole responses. They are
+    // gathered by a first pass over the tiles, the second one filtering
+    // them again, so no complex response of the whole image is kept.
+    vector<Vec<_Tp, 2> > means;
+    vector<_Tp> stds;
+    if(needZMUNorm)
+    {
+        vector<double> sums(3*numFilters, 0.0);
+        Mutex sumsMutex;
+
+        TiledFilteringBody<_Tp> statisticsBody(image, tilePlan,
+                &rowSources.front(), outputRows, &colSources.front(),
+                outputCols, tileCols, &sums.front(), sumsMutex, workspaces);
+
+        parallel_for(BlockedRange(0, tileRows*tileCols), statisticsBody);
 
+        // Same estimate as ImageHelpers::zmuMagnitude
+        double elems = (double)outputRows*outputCols;
+        means.resize(numFilters);
+        stds.resize(numFilters);
+        for(int i=0; i<numFilters; i++)
+        {
+            double meanReal = sums[3*i] / elems;
+            double meanImag = sums[3*i + 1] / elems;
+            double variance = (sums[3*i + 2] - elems*(meanReal*meanReal +
+                    meanImag*meanImag)) / (elems - 1);
+            means[i] = Vec<_Tp, 2>((_Tp)meanReal, (_Tp)meanImag);
+            stds[i] = (_Tp)sqrt(std::max(variance, 0.0));
+        }
+    }
+
+    dst.create(numFilters, outputRows*outputCols);
+
+    TiledFilteringBody<_Tp> tiledFilteringBody(image, tilePlan,
+            &rowSources.front(), outputRows, &colSources.front(),
+            outputCols, tileCols, means.empty() ? 0 : &means.front(),
+            stds.empty() ? 0 : &stds.front(), magnitudeMode, dst,
+            workspaces);
+
+    parallel_for(BlockedRange(0, tileRows*tileCols), tiledFilteringBody);
 }
 
+template<typename _Tp>
+Size FilteringHelpers::getTileSize(const FilterBank<_Tp>& filterBank)
+{
+    return (Size(getOptimalDFTSize(max(FILTERING_TILE_SIZE,
+            2*(filterBank.getFilterSizeY() - 1))),
+            getOptimalDFTSize(max(FILTERING_TILE_SIZE,
+            2*(filterBank.getFilterSizeX() - 1)))));
+}
 
 }
 
@@ -0,0 +1,194 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef FILTERINGWORKSPACE_HPP_
+#define FILTERINGWORKSPACE_HPP_
+
+// TODO: Check really needed header files, including all OpenCV headers
+// is way too much
+#include "opencv2/opencv.hpp"
+#include "FFTBackend.hpp"
+#include <vector>
+
+namespace fex
+{
+
+using namespace cv;
+
+/*
+ * Scratch buffers of FilteringHelpers::imageApplyGaborSet
+ */
+enum
+{
+    FILTERING_WORKSPACE_PADDED = 0,
+    FILTERING_WORKSPACE_SPECTRA = 1,
+    FILTERING_WORKSPACE_REAL_SPECTRA = 2,
+    FILTERING_WORKSPACE_PRODUCTS = 3,
+    FILTERING_WORKSPACE_FULL_PRODUCT = 4,
+    FILTERING_WORKSPACE_RESPONSES = 5,
+    FILTERING_WORKSPACE_REAL_PRODUCTS = 6,
+    FILTERING_WORKSPACE_REAL_RESPONSES = 7,
+    FILTERING_WORKSPACE_RESPONSE = 8,
+    FILTERING_WORKSPACE_DOWNSAMPLED = 9,
+    FILTERING_WORKSPACE_IMAGE = 10,
+    FILTERING_WORKSPACE_TERM = 11,
+    FILTERING_WORKSPACE_RECURSIVE_PADDED = 12,
+    FILTERING_WORKSPACE_DEMODULATED = 13,
+    FILTERING_WORKSPACE_BUFFERS = 14
+};
+
+// Alignment of the buffers, enough for any SIMD unit and FFTW plan
+const int FILTERING_WORKSPACE_ALIGNMENT = 64;
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                           FilteringWorkspace                             ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Scratch memory of a single filtering task.
+ *
+ * Buffers only grow, and are handed out as aligned headers of the size
+ * asked for. Functions filling a header of the right size and type with
+ * Mat::create write into it in place, so once a workspace has seen the
+ * largest geometry it processes, nothing is allocated per image.
+ *
+ * A workspace must only be used by one thread at a time.
+ */
+class FilteringWorkspace
+{
+public:
+
+    FilteringWorkspace();
+
+    /*
+     * Aligned header of rows x cols elements of the given type over buffer
+     * index. Its previous content is undefined.
+     */
+    Mat getBuffer(int index, int rows, int cols, int type);
+
+    // Slot of each filter in the batched spectrum products
+    vector<int> slots;
+
+    // Backend of the transforms of the task, the default one when the
+    // workspace was created or last acquired from a pool
+    Ptr<FFTBackend> fft;
+
+private:
+
+    Mat mStorage[FILTERING_WORKSPACE_BUFFERS];
+};
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                         FilteringWorkspacePool                           ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Workspaces shared by the tasks of a parallel_for. Each task takes one for
+ * its whole range and gives it back at the end, so a pool kept across calls
+ * holds one warm workspace per concurrent task.
+ */
+class FilteringWorkspacePool
+{
+public:
+
+    Ptr<FilteringWorkspace> acquire();
+    void release(const Ptr<FilteringWorkspace>& workspace);
+
+    /*
+     * Frees the workspaces not in use
+     */
+    void clear();
+
+private:
+
+    vector<Ptr<FilteringWorkspace> > mWorkspaces;
+    Mutex mMutex;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+inline FilteringWorkspace::FilteringWorkspace() :
+    fft(FFTBackend::getDefault())
+{
+}
+
+inline Mat FilteringWorkspace::getBuffer(int index, int rows, int cols,
+        int type)
+{
+    CV_Assert((index >= 0) && (index < FILTERING_WORKSPACE_BUFFERS));
+
+    size_t size = (size_t)rows * cols * CV_ELEM_SIZE(type) +
+            FILTERING_WORKSPACE_ALIGNMENT;
+    Mat& storage = mStorage[index];
+    if(storage.empty() || ((size_t)storage.cols < size))
+    {
+        storage.create(1, (int)size, CV_8U);
+    }
+
+    return (Mat(rows, cols, type,
+            alignPtr(storage.data, FILTERING_WORKSPACE_ALIGNMENT)));
+}
+
+inline Ptr<FilteringWorkspace> FilteringWorkspacePool::acquire()
+{
+    AutoLock lock(mMutex);
+
+    if(mWorkspaces.empty())
+    {
+        return (Ptr<FilteringWorkspace>(new FilteringWorkspace()));
+    }
+
+    // Tasks started after a change of the default backend use the new one
+    Ptr<FilteringWorkspace> workspace = mWorkspaces.back();
+    mWorkspaces.pop_back();
+    workspace->fft = FFTBackend::getDefault();
+    return (workspace);
+}
+
+inline void FilteringWorkspacePool::release(
+        const Ptr<FilteringWorkspace>& workspace)
+{
+    AutoLock lock(mMutex);
+    mWorkspaces.push_back(workspace);
+}
+
+inline void FilteringWorkspacePool::clear()
+{
+    AutoLock lock(mMutex);
+    mWorkspaces.clear();
+}
+
+}
+
+#endif /* FILTERINGWORKSPACE_HPP_ */
@@ -0,0 +1,483 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef FIXEDGABORSET_HPP_
+#define FIXEDGABORSET_HPP_
+
+// TODO: Check really needed header files, including all OpenCV headers
+// is way too much
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/internal.hpp"
+#include "GaborSet.hpp"
+#include "GaborFilteringPlan.hpp"
+#include "FilteringWorkspace.hpp"
+#include <vector>
+#include <cstring>
+
+namespace fex
+{
+
+using namespace cv;
+
+/*
+ * Compile-time counterpart of getOptimalDFTSize: the smallest number of the
+ * form 2^a 3^b 5^c not lower than N.
+ */
+template<int N, int F, bool Divisible = (N % F == 0)> struct StripFactor
+{
+    enum { value = N };
+};
+
+template<int N, int F> struct StripFactor<N, F, true>
+{
+    enum { value = StripFactor<N / F, F>::value };
+};
+
+template<int N> struct IsRegularNumber
+{
+    enum { value = (StripFactor<StripFactor<StripFactor<N, 2>::value,
+            3>::value, 5>::value == 1) };
+};
+
+template<int N, bool Regular = IsRegularNumber<N>::value>
+struct OptimalDFTSize
+{
+    enum { value = OptimalDFTSize<N + 1>::value };
+};
+
+template<int N> struct OptimalDFTSize<N, true>
+{
+    enum { value = N };
+};
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                            FixedGaborSetBody                             ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Template class for parallel filtering with a fixed geometry Gabor set
+ */
+template<typename _Set> class FixedGaborSetBody
+{
+public:
+
+	/*
+	 * Typedefs
+	 */
+	typedef typename _Set::value_type _Tp;
+
+	/*
+	 * Constructor
+	 */
+	FixedGaborSetBody(const _Set* _filterSet, const Mat_<_Tp>* _input,
+			Mat_<_Tp> _output, FilteringWorkspacePool& _workspaces);
+
+	/*
+	 * TBB operator
+	 */
+	void operator() (const BlockedRange& range ) const;
+
+private:
+
+	/*
+	 * Input and output arguments
+	 */
+	const Mat_<_Tp>* input;
+	Mat_<_Tp> output;
+
+	/*
+	 * Arguments needed for computation
+	 */
+	const _Set* mFilterSet;
+	FilteringWorkspacePool* mWorkspaces;
+};
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                              FixedGaborSet                               ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Template class for a Gabor set whose whole geometry is known at compile
+ * time: Scales x Orientations filters of FilterSizeX x FilterSizeY applied to
+ * Rows x Cols images, whose responses are downsampled by taking one pixel
+ * every DownSamplingStep along each axis.
+ *
+ * The bank size, DFT size and output lengths are compile-time constants and
+ * the spectra live in the object, so the filtering loops have fixed trip
+ * counts. The per-image buffers are aligned FilteringWorkspace buffers of
+ * the DFT size, too large for the stack of a worker, which are allocated
+ * once per workspace and reused. Objects hold every spectrum, so they are
+ * large: allocate them once, statically or with new.
+ *
+ * The features are the ones of FilteringHelpers::imageApplyGaborSet with an
+ * FFT plan of GaborSet(Scales, Orientations, FilterSizeX, FilterSizeY, kMax,
+ * sigma) and a downsampling ratio of 1/DownSamplingStep, which must be a
+ * power of two dividing the image size so that both sample the same pixels.
+ */
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep = 1, int FilterSizeX = Rows,
+		int FilterSizeY = Cols>
+class FixedGaborSet
+{
+public:
+	/*
+	 * Typedefs
+	 */
+	typedef _Tp value_type;
+
+	/*
+	 * Geometry
+	 */
+	enum
+	{
+		NUM_FILTERS = Scales * Orientations,
+		// Same frame as GaborFilteringPlan: filters of the image size are
+		// applied circularly if it is an optimal DFT size, the others on a
+		// frame padded past the image by the filter centre
+		CIRCULAR = (FilterSizeX == Rows) && (FilterSizeY == Cols) &&
+				(OptimalDFTSize<Rows>::value == Rows) &&
+				(OptimalDFTSize<Cols>::value == Cols),
+		FILTER_CENTRE_ROW = FilterSizeX / 2,
+		FILTER_CENTRE_COL = FilterSizeY / 2,
+		DFT_ROWS = CIRCULAR ? Rows : OptimalDFTSize<FILTER_CENTRE_ROW +
+				((Rows > FilterSizeX - FILTER_CENTRE_ROW) ?
+				Rows : FilterSizeX - FILTER_CENTRE_ROW)>::value,
+		DFT_COLS = CIRCULAR ? Cols : OptimalDFTSize<FILTER_CENTRE_COL +
+				((Cols > FilterSizeY - FILTER_CENTRE_COL) ?
+				Cols : FilterSizeY - FILTER_CENTRE_COL)>::value,
+		DFT_AREA = DFT_ROWS * DFT_COLS,
+		// Position of the response of the first pixel
+		RESPONSE_ROW = CIRCULAR ? 0 : FILTER_CENTRE_ROW,
+		RESPONSE_COL = CIRCULAR ? 0 : FILTER_CENTRE_COL,
+		OUTPUT_ROWS = Rows / DownSamplingStep,
+		OUTPUT_COLS = Cols / DownSamplingStep,
+		OUTPUT_AREA = OUTPUT_ROWS * OUTPUT_COLS,
+		// Features per image, as a row of imageApplyGaborSetToMatVector
+		ROW_LENGTH = NUM_FILTERS * OUTPUT_AREA
+	};
+
+	/*
+	 * Constructors
+	 */
+	FixedGaborSet(_Tp _kMax, _Tp _sigma, bool _needZMUNormalization,
+			int _method = GABOR_SPATIAL_DOMAIN);
+	virtual ~FixedGaborSet();
+
+	/*
+	 * Methods
+	 *
+	 * apply() writes the NUM_FILTERS x OUTPUT_AREA features of an image, as
+	 * imageApplyGaborSet does, and can be called from several threads. Its
+	 * buffers and FFT backend come from the workspace given, or from a pool
+	 * of the object.
+	 */
+	void apply(const Mat_<_Tp>& image, _Tp* dst,
+			FilteringWorkspace& workspace) const;
+	void apply(const Mat_<_Tp>& image, _Tp* dst) const;
+	void apply(const Mat_<_Tp>& image, Mat_<_Tp>& dst) const;
+	void applyToMatVector(const vector<Mat_<_Tp> >& mat,
+			Mat_<_Tp>& features) const;
+
+	/*
+	 * Attribute getters
+	 */
+	_Tp getKMax() const;
+	_Tp getSigma() const;
+	bool needZMUNormalization() const;
+	int getMethod() const;
+
+private:
+	/*
+	 * Compile-time checks
+	 */
+	typedef char DownSamplingStepMustBeAPowerOfTwo[
+			((DownSamplingStep > 0) &&
+			((DownSamplingStep & (DownSamplingStep - 1)) == 0)) ? 1 : -1];
+	typedef char DownSamplingStepMustDivideTheImage[
+			((Rows % DownSamplingStep == 0) &&
+			(Cols % DownSamplingStep == 0)) ? 1 : -1];
+
+	/*
+	 * Attributes
+	 */
+	_Tp mKMax;
+	_Tp mSigma;
+	bool mNeedZMUNormalization;
+	int mMethod;
+	Vec<_Tp, 2> mSpectra[NUM_FILTERS * DFT_AREA];
+	// Workspaces of the calls not given one
+	mutable FilteringWorkspacePool mWorkspaces;
+
+	/*
+	 * Copies are as large as the spectra, they are not allowed
+	 */
+	FixedGaborSet(const FixedGaborSet&);
+	FixedGaborSet& operator=(const FixedGaborSet&);
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/*************
+ * Constructor
+ *************/
+template<typename _Set>
+FixedGaborSetBody<_Set>::FixedGaborSetBody(const _Set* _filterSet,
+		const Mat_<_Tp>* _input, Mat_<_Tp> _output,
+		FilteringWorkspacePool& _workspaces) : input(_input),
+		output(_output), mFilterSet(_filterSet), mWorkspaces(&_workspaces) {}
+
+/**************
+ * TBB Operator
+ **************/
+template<typename _Set>
+void FixedGaborSetBody<_Set>::operator() (const BlockedRange& range ) const
+{
+	// The workspace of the task is kept for its whole range
+	Ptr<FilteringWorkspace> workspace = mWorkspaces->acquire();
+
+	for( int index=range.begin(); index!=range.end( ); ++index )
+	{
+		mFilterSet->apply(input[index], ((Mat)output).ptr<_Tp>(index),
+				*workspace);
+	}
+
+	mWorkspaces->release(workspace);
+}
+
+/**************
+ * Constructors
+ **************/
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols, DownSamplingStep,
+		FilterSizeX, FilterSizeY>::FixedGaborSet(_Tp _kMax, _Tp _sigma,
+		bool _needZMUNormalization, int _method) : mKMax(_kMax),
+		mSigma(_sigma), mNeedZMUNormalization(_needZMUNormalization),
+		mMethod(_method)
+{
+	GaborSet<_Tp> filterSet(Scales, Orientations, FilterSizeX, FilterSizeY,
+			mKMax, mSigma, true, mMethod);
+	GaborFilteringPlan<_Tp> plan(filterSet, Size(Cols, Rows));
+
+	CV_Assert((plan.getDFTSize() == Size(DFT_COLS, DFT_ROWS)) &&
+			(plan.getResponseArea().tl() ==
+			Point(RESPONSE_COL, RESPONSE_ROW)));
+
+	for(int i=0; i<NUM_FILTERS; i++)
+	{
+		memcpy(mSpectra + i*DFT_AREA, plan.getFilterFFTPtr(i),
+				DFT_AREA * sizeof(Vec<_Tp, 2>));
+	}
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols, DownSamplingStep,
+		FilterSizeX, FilterSizeY>::~FixedGaborSet()
+{
+}
+
+/*******************
+ * Attribute getters
+ *******************/
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+inline _Tp FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols,
+		DownSamplingStep, FilterSizeX, FilterSizeY>::getKMax() const
+{
+	return (mKMax);
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+inline _Tp FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols,
+		DownSamplingStep, FilterSizeX, FilterSizeY>::getSigma() const
+{
+	return (mSigma);
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+inline bool FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols,
+		DownSamplingStep, FilterSizeX, FilterSizeY>::needZMUNormalization()
+		const
+{
+	return (mNeedZMUNormalization);
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+inline int FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols,
+		DownSamplingStep, FilterSizeX, FilterSizeY>::getMethod() const
+{
+	return (mMethod);
+}
+
+/*********
+ * Methods
+ *********/
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+void FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols, DownSamplingStep,
+		FilterSizeX, FilterSizeY>::apply(const Mat_<_Tp>& image,
+		_Tp* dst, FilteringWorkspace& workspace) const
+{
+	CV_Assert((image.rows == Rows) && (image.cols == Cols));
+
+	int complexType = DataType<Vec<_Tp, 2> >::type;
+	Mat_<_Tp> paddedHeader = workspace.getBuffer(FILTERING_WORKSPACE_PADDED,
+			DFT_ROWS, DFT_COLS, DataType<_Tp>::type);
+	Mat_<Vec<_Tp, 2> > imageFFTHeader = workspace.getBuffer(
+			FILTERING_WORKSPACE_SPECTRA, DFT_ROWS, DFT_COLS, complexType);
+	Mat_<Vec<_Tp, 2> > responseHeader = workspace.getBuffer(
+			FILTERING_WORKSPACE_RESPONSE, DFT_ROWS, DFT_COLS, complexType);
+	_Tp* padded = paddedHeader[0];
+	const Vec<_Tp, 2>* imageFFT = imageFFTHeader[0];
+	Vec<_Tp, 2>* response = responseHeader[0];
+
+	// The image is real, so it is transformed from a zero padded real buffer
+	// straight into the full complex spectrum; rows past the image are zero
+	// and the forward transform skips them. Buffers are shared with other
+	// users of the workspace, so the padding is cleared on every call.
+	for(int i=0; i<Rows; i++)
+	{
+		memcpy(padded + i*DFT_COLS, image[i], Cols * sizeof(_Tp));
+		memset(padded + i*DFT_COLS + Cols, 0,
+				(DFT_COLS - Cols) * sizeof(_Tp));
+	}
+	memset(padded + Rows*DFT_COLS, 0,
+			(DFT_ROWS - Rows) * DFT_COLS * sizeof(_Tp));
+	FFTBackend* fft = workspace.fft;
+	fft->dft(paddedHeader, imageFFTHeader, DFT_COMPLEX_OUTPUT, Rows);
+
+	for(int filter=0; filter<NUM_FILTERS; filter++)
+	{
+		const Vec<_Tp, 2>* spectrum = mSpectra + filter*DFT_AREA;
+		ImageHelpers::multiplyComplexRow((const _Tp*)imageFFT,
+				(const _Tp*)spectrum, (_Tp*)response, DFT_AREA);
+		fft->idft(responseHeader, responseHeader,
+				DFT_COMPLEX_OUTPUT + DFT_SCALE);
+
+		_Tp* features = dst + filter*OUTPUT_AREA;
+		_Tp meanReal = 0;
+		_Tp meanImag = 0;
+		_Tp std = 1;
+
+		if(mNeedZMUNormalization)
+		{
+			// Same two pass statistics as ImageHelpers::zmuNormalization
+			for(int i=0; i<OUTPUT_ROWS; i++)
+			{
+				const Vec<_Tp, 2>* row = response + (RESPONSE_ROW +
+						i*DownSamplingStep)*DFT_COLS + RESPONSE_COL;
+				for(int j=0; j<OUTPUT_COLS; j++)
+				{
+					meanReal += row[j*DownSamplingStep][0];
+					meanImag += row[j*DownSamplingStep][1];
+				}
+			}
+			meanReal /= OUTPUT_AREA;
+			meanImag /= OUTPUT_AREA;
+
+			_Tp varReal = 0;
+			_Tp varImag = 0;
+			for(int i=0; i<OUTPUT_ROWS; i++)
+			{
+				const Vec<_Tp, 2>* row = response + (RESPONSE_ROW +
+						i*DownSamplingStep)*DFT_COLS + RESPONSE_COL;
+				for(int j=0; j<OUTPUT_COLS; j++)
+				{
+					_Tp real = row[j*DownSamplingStep][0] - meanReal;
+					_Tp imag = row[j*DownSamplingStep][1] - meanImag;
+					varReal += real*real;
+					varImag += imag*imag;
+				}
+			}
+			std = sqrt(varReal/(OUTPUT_AREA - 1) +
+					varImag/(OUTPUT_AREA - 1));
+		}
+
+		for(int i=0; i<OUTPUT_ROWS; i++)
+		{
+			const Vec<_Tp, 2>* row = response + (RESPONSE_ROW +
+					i*DownSamplingStep)*DFT_COLS + RESPONSE_COL;
+			for(int j=0; j<OUTPUT_COLS; j++)
+			{
+				_Tp real = (row[j*DownSamplingStep][0] - meanReal) / std;
+				_Tp imag = (row[j*DownSamplingStep][1] - meanImag) / std;
+				features[i*OUTPUT_COLS + j] = sqrt(real*real + imag*imag);
+			}
+		}
+	}
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+void FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols, DownSamplingStep,
+		FilterSizeX, FilterSizeY>::apply(const Mat_<_Tp>& image,
+		_Tp* dst) const
+{
+	Ptr<FilteringWorkspace> workspace = mWorkspaces.acquire();
+	apply(image, dst, *workspace);
+	mWorkspaces.release(workspace);
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+void FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols, DownSamplingStep,
+		FilterSizeX, FilterSizeY>::apply(const Mat_<_Tp>& image,
+		Mat_<_Tp>& dst) const
+{
+	dst.create(NUM_FILTERS, OUTPUT_AREA);
+	apply(image, ((Mat)dst).ptr<_Tp>(0));
+}
+
+template<typename _Tp, int Scales, int Orientations, int Rows, int Cols,
+		int DownSamplingStep, int FilterSizeX, int FilterSizeY>
+void FixedGaborSet<_Tp, Scales, Orientations, Rows, Cols, DownSamplingStep,
+		FilterSizeX, FilterSizeY>::applyToMatVector(
+		const vector<Mat_<_Tp> >& mat, Mat_<_Tp>& features) const
+{
+	int numImages = mat.size();
+	features.create(numImages, ROW_LENGTH);
+
+	FixedGaborSetBody<FixedGaborSet> fixedGaborSetBody(this, &mat.front(),
+			features, mWorkspaces);
+
+	parallel_for(BlockedRange(0, numImages), fixedGaborSetBody);
+}
+
+}
+
+#endif /* FIXEDGABORSET_HPP_ */
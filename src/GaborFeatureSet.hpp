@@ -38,6 +38,10 @@ namespace fex {
  * compiling, since OpenCV mat's structure does not support them.
  *
  * Using int type is not allowed, and will cause a runtime error.
+ *
+ * With downsampling, a ratio per filter may be given instead of a single
+ * one, such as the ones of FilteringHelpers::getDownSamplingRatios, which
+ * sample coarse scales more sparsely than fine ones.
  */
 template <typename _Tp> class GaborFeatureSet : public FeatureSet<_Tp> {
 public:
@@ -50,9 +54,14 @@ public:
 	 * Constructors
 	 */
 	GaborFeatureSet();
-	GaborFeatureSet(GaborSet<_Tp> _filterSet, _Tp _variabilityRate,
+	GaborFeatureSet(const FilterBank<_Tp>& _filterBank, _Tp _variabilityRate,
 	        bool _needZMUNormalization,	bool _needDownSampling,
-	        bool _storeRawFeatures=false, _Tp _downsamplingRatio=1.0f);
+	        bool _storeRawFeatures=false, _Tp _downsamplingRatio=1.0f,
+	        int _filteringBackend=FILTERING_FFT,
+	        int _downSamplingMethod=DOWNSAMPLING_FOLD,
+	        int _channelCombination=CHANNELS_CONCATENATE,
+	        int _magnitudeMode=MAGNITUDE_EXACT,
+	        const vector<_Tp>& _downSamplingRatios=vector<_Tp>());
 	virtual ~GaborFeatureSet();
 
 	/*
@@ -62,6 +71,28 @@ public:
 	void projectData(vector<Mat_<_Tp> >& mat, Mat_<_Tp>& dst);
 	void reduceRawFeatureSet(double variabilityRate);
 
+	/*
+	 * Same as above for images of another type, such as 8 or 16 bit ones,
+	 * which are converted to _Tp during the filtering of each image. The
+	 * features of multi-channel images are combined as the channel
+	 * combination of the set says.
+	 */
+	template <typename _Ip>
+	void generateFeatureSet(vector<Mat_<_Ip> >& mat);
+	template <typename _Ip>
+	void projectData(vector<Mat_<_Ip> >& mat, Mat_<_Tp>& dst);
+
+	/*
+	 * Same as generateFeatureSet() and projectData() for several sets on the
+	 * same images, with one forward spectrum per image shared by all the
+	 * sets. They must use the same normalization, downsampling, channel
+	 * combination and magnitude mode, and dst gets one matrix per set.
+	 */
+	static void generateFeatureSets(vector<GaborFeatureSet<_Tp>*>& sets,
+			vector<Mat_<_Tp> >& mat);
+	static void projectDataSets(vector<GaborFeatureSet<_Tp>*>& sets,
+			vector<Mat_<_Tp> >& mat, vector<Mat_<_Tp> >& dst);
+
 	/*
 	 * Attribute getters
 	 */
@@ -73,12 +104,23 @@ private:
     /*
      * Attributes
      */
-	GaborSet<_Tp> mGaborSet;
+	// Any bank can be used, a GaborSet by default
+	Ptr<FilterBank<_Tp> > mFilterBank;
+	// Filtering plan for the geometry of the last images processed
+	GaborFilteringPlan<_Tp> mPlan;
+	// Scratch memory of the filtering tasks, kept warm across calls
+	Ptr<FilteringWorkspacePool> mWorkspaces;
 	_Tp mVariabilityRate;
 	bool mNeedZMUNormalization;
 	bool mNeedDownSampling;
 	bool mStoreRawFeatures;
 	_Tp mDownSamplingRatio;
+	// Ratio of each filter, empty when they all use mDownSamplingRatio
+	vector<_Tp> mDownSamplingRatios;
+	int mFilteringBackend;
+	int mDownSamplingMethod;
+	int mChannelCombination;
+	int mMagnitudeMode;
 	Mat_<_Tp> mFeatures;
 	Mat_<_Tp> mCoefficients;
 	Mat_<_Tp> mTrainingData;
@@ -86,9 +128,21 @@ private:
 	/*
 	 * Methods
 	 */
-	void init(GaborSet<_Tp> filterSet, _Tp variabilityRate,
+	void init(const FilterBank<_Tp>& filterBank, _Tp variabilityRate,
 			bool needZMUNormalization, bool needDownSampling,
-			bool storeRawFeatures, _Tp downsamplingRatio);
+			bool storeRawFeatures, _Tp downsamplingRatio,
+			int filteringBackend, int downSamplingMethod,
+			int channelCombination, int magnitudeMode,
+			const vector<_Tp>& downSamplingRatios);
+
+	const GaborFilteringPlan<_Tp>& getPlan(Size imageSize,
+			Size minDFTSize = Size());
+
+	template <typename _Ip>
+	void applyFilterBank(vector<Mat_<_Ip> >& mat, Mat_<_Tp>& features);
+
+	static void applyFilterBanks(vector<GaborFeatureSet<_Tp>*>& sets,
+			vector<Mat_<_Tp> >& mat, vector<Mat_<_Tp> >& features);
 
 };
 
@@ -98,13 +152,17 @@ GaborFeatureSet<_Tp>::GaborFeatureSet()
 }
 
 template <typename _Tp>
-GaborFeatureSet<_Tp>::GaborFeatureSet(GaborSet<_Tp> _filterSet,
+GaborFeatureSet<_Tp>::GaborFeatureSet(const FilterBank<_Tp>& _filterBank,
         _Tp _variabilityRate, bool _needZMUNormalization,
         bool _needDownSampling, bool _storeRawFeatures,
-        _Tp _downsamplingRatio)
+        _Tp _downsamplingRatio, int _filteringBackend,
+        int _downSamplingMethod, int _channelCombination, int _magnitudeMode,
+        const vector<_Tp>& _downSamplingRatios)
 {
-	init(_filterSet, _variabilityRate, _needZMUNormalization, _needDownSampling,
-			_storeRawFeatures, _downsamplingRatio);
+	init(_filterBank, _variabilityRate, _needZMUNormalization,
+			_needDownSampling, _storeRawFeatures, _downsamplingRatio,
+			_filteringBackend, _downSamplingMethod, _channelCombination,
+			_magnitudeMode, _downSamplingRatios);
 }
 
 
@@ -138,12 +196,25 @@ inline Mat_<_Tp> GaborFeatureSet<_Tp>::getFeatures() const
 template <typename _Tp>
 void GaborFeatureSet<_Tp>::generateFeatureSet(
          vector<Mat_<_Tp> >& mat)
+{
+    this->template generateFeatureSet<_Tp>(mat);
+}
+
+template <typename _Tp>
+void GaborFeatureSet<_Tp>::projectData(vector<Mat_<_Tp> >& mat,
+        Mat_<_Tp>& dst)
+{
+    this->template projectData<_Tp>(mat, dst);
+}
+
+template <typename _Tp>
+template <typename _Ip>
+void GaborFeatureSet<_Tp>::generateFeatureSet(
+         vector<Mat_<_Ip> >& mat)
 {
     Mat_<_Tp> features;
 
-    FilteringHelpers::imageApplyGaborSetToMatVector(mat, this->mGaborSet,
-            features, this->mNeedZMUNormalization, this->mNeedDownSampling,
-            this->mDownSamplingRatio);
+    applyFilterBank(mat, features);
 
 	if(mStoreRawFeatures)
 	{
@@ -155,18 +226,76 @@ void GaborFeatureSet<_Tp>::generateFeatureSet(
 }
 
 template <typename _Tp>
-void GaborFeatureSet<_Tp>::projectData(vector<Mat_<_Tp> >& mat,
+template <typename _Ip>
+void GaborFeatureSet<_Tp>::projectData(vector<Mat_<_Ip> >& mat,
         Mat_<_Tp>& dst)
 {
     Mat_<_Tp> features;
 
-    FilteringHelpers::imageApplyGaborSetToMatVector(mat, this->mGaborSet,
-            features, this->mNeedZMUNormalization, this->mNeedDownSampling,
-            this->mDownSamplingRatio);
+    applyFilterBank(mat, features);
 
     dst = features * mCoefficients;
 }
 
+template <typename _Tp>
+void GaborFeatureSet<_Tp>::generateFeatureSets(
+        vector<GaborFeatureSet<_Tp>*>& sets, vector<Mat_<_Tp> >& mat)
+{
+    vector<Mat_<_Tp> > features;
+
+    applyFilterBanks(sets, mat, features);
+
+    for(size_t s=0; s<sets.size(); s++)
+    {
+        if(sets[s]->mStoreRawFeatures)
+        {
+            ((Mat)features[s]).copyTo(sets[s]->mFeatures);
+        }
+
+        MathHelpers::pcaReduceData(features[s], sets[s]->mVariabilityRate,
+                sets[s]->mTrainingData, sets[s]->mCoefficients);
+    }
+}
+
+template <typename _Tp>
+void GaborFeatureSet<_Tp>::projectDataSets(
+        vector<GaborFeatureSet<_Tp>*>& sets, vector<Mat_<_Tp> >& mat,
+        vector<Mat_<_Tp> >& dst)
+{
+    vector<Mat_<_Tp> > features;
+
+    applyFilterBanks(sets, mat, features);
+
+    dst.resize(sets.size());
+    for(size_t s=0; s<sets.size(); s++)
+    {
+        dst[s] = features[s] * sets[s]->mCoefficients;
+    }
+}
+
+template <typename _Tp>
+template <typename _Ip>
+void GaborFeatureSet<_Tp>::applyFilterBank(vector<Mat_<_Ip> >& mat,
+        Mat_<_Tp>& features)
+{
+    const GaborFilteringPlan<_Tp>& plan = getPlan(((Mat)mat.front()).size());
+
+    if(!mDownSamplingRatios.empty())
+    {
+        FilteringHelpers::imageApplyGaborSetToMatVector(mat, plan, features,
+                this->mNeedZMUNormalization, this->mDownSamplingRatios,
+                this->mDownSamplingMethod, this->mChannelCombination,
+                this->mMagnitudeMode, this->mWorkspaces);
+        return;
+    }
+
+    FilteringHelpers::imageApplyGaborSetToMatVector(mat, plan, features,
+            this->mNeedZMUNormalization, this->mNeedDownSampling,
+            this->mDownSamplingRatio, this->mDownSamplingMethod,
+            this->mChannelCombination, this->mMagnitudeMode,
+            this->mWorkspaces);
+}
+
 template <typename _Tp>
 void GaborFeatureSet<_Tp>::reduceRawFeatureSet(double variabilityRate)
 {
@@ -179,12 +308,19 @@ void GaborFeatureSet<_Tp>::reduceRawFeatureSet(double variabilityRate)
 }
 
 template <typename _Tp>
-void GaborFeatureSet<_Tp>::init(GaborSet<_Tp> filterSet,
+void GaborFeatureSet<_Tp>::init(const FilterBank<_Tp>& filterBank,
         _Tp variabilityRate, bool needZMUNormalization,
         bool needDownSampling, bool storeRawFeatures,
-        _Tp downsamplingRatio)
+        _Tp downsamplingRatio, int filteringBackend, int downSamplingMethod,
+        int channelCombination, int magnitudeMode,
+        const vector<_Tp>& downSamplingRatios)
 {
-	mGaborSet = filterSet;
+	mFilterBank = filterBank.clone();
+	mFilteringBackend = filteringBackend;
+	mDownSamplingMethod = downSamplingMethod;
+	mChannelCombination = channelCombination;
+	mMagnitudeMode = magnitudeMode;
+	mWorkspaces = new FilteringWorkspacePool();
 	mVariabilityRate = variabilityRate;
 	mNeedZMUNormalization = needZMUNormalization;
 	mNeedDownSampling = needDownSampling;
@@ -192,12 +328,108 @@ void GaborFeatureSet<_Tp>::init(GaborSet<_Tp> filterSet,
 	if(!mNeedDownSampling)
 	{
 	    mDownSamplingRatio = 1;
+	    mDownSamplingRatios.clear();
 	}
 	else {
 	    mDownSamplingRatio = downsamplingRatio;
+	    mDownSamplingRatios = downSamplingRatios;
+	    CV_Assert(mDownSamplingRatios.empty() ||
+	            ((int)mDownSamplingRatios.size() ==
+	            filterBank.getNumFilters()));
 	}
 }
 
+template <typename _Tp>
+const GaborFilteringPlan<_Tp>& GaborFeatureSet<_Tp>::getPlan(Size imageSize,
+        Size minDFTSize)
+{
+    if(mPlan.empty() || (mPlan.getImageSize() != imageSize) ||
+            (mPlan.getDFTSize().width < minDFTSize.width) ||
+            (mPlan.getDFTSize().height < minDFTSize.height))
+    {
+        // Ratios per filter are not applied in the frequency domain
+        int step = 1;
+        if(mDownSamplingRatios.empty())
+        {
+            step = FilteringHelpers::getPlanDownSamplingStep(
+                    mNeedDownSampling, mDownSamplingRatio,
+                    mDownSamplingMethod);
+        }
+        mPlan = GaborFilteringPlan<_Tp>(*mFilterBank, imageSize,
+                mFilteringBackend, false, step, minDFTSize);
+        // Buffers sized for the previous geometry are not needed anymore
+        mWorkspaces->clear();
+    }
+    return (mPlan);
+}
+
+template <typename _Tp>
+void GaborFeatureSet<_Tp>::applyFilterBanks(
+        vector<GaborFeatureSet<_Tp>*>& sets, vector<Mat_<_Tp> >& mat,
+        vector<Mat_<_Tp> >& features)
+{
+    CV_Assert(!sets.empty());
+
+    GaborFeatureSet<_Tp>* first = sets.front();
+    Size imageSize = ((Mat)mat.front()).size();
+
+    // Plans are first built for each set alone, then those smaller than the
+    // largest one are rebuilt at its DFT size. Rebuilt plans of filters of
+    // the image size get padded, and can grow it again.
+    Size minDFTSize;
+    for(size_t s=0; s<sets.size(); s++)
+    {
+        CV_Assert((sets[s]->mNeedZMUNormalization ==
+                first->mNeedZMUNormalization) &&
+                (sets[s]->mNeedDownSampling == first->mNeedDownSampling) &&
+                (sets[s]->mDownSamplingRatio == first->mDownSamplingRatio) &&
+                (sets[s]->mDownSamplingMethod == first->mDownSamplingMethod) &&
+                (sets[s]->mChannelCombination == first->mChannelCombination) &&
+                (sets[s]->mMagnitudeMode == first->mMagnitudeMode) &&
+                (sets[s]->mDownSamplingRatios.empty() ==
+                first->mDownSamplingRatios.empty()));
+
+        Size dftSize = sets[s]->getPlan(imageSize).getDFTSize();
+        minDFTSize.width = max(minDFTSize.width, dftSize.width);
+        minDFTSize.height = max(minDFTSize.height, dftSize.height);
+    }
+
+    vector<const GaborFilteringPlan<_Tp>*> plans(sets.size());
+    Size dftSize;
+    do
+    {
+        dftSize = minDFTSize;
+        for(size_t s=0; s<sets.size(); s++)
+        {
+            plans[s] = &sets[s]->getPlan(imageSize, dftSize);
+            minDFTSize.width = max(minDFTSize.width,
+                    plans[s]->getDFTSize().width);
+            minDFTSize.height = max(minDFTSize.height,
+                    plans[s]->getDFTSize().height);
+        }
+    } while(minDFTSize != dftSize);
+
+    if(!first->mDownSamplingRatios.empty())
+    {
+        vector<vector<_Tp> > ratios(sets.size());
+        for(size_t s=0; s<sets.size(); s++)
+        {
+            ratios[s] = sets[s]->mDownSamplingRatios;
+        }
+        FilteringHelpers::imageApplyFilterBanksToMatVector(mat, plans,
+                features, first->mNeedZMUNormalization, ratios,
+                first->mDownSamplingMethod, first->mChannelCombination,
+                first->mMagnitudeMode, first->mWorkspaces);
+        return;
+    }
+
+    FilteringHelpers::imageApplyFilterBanksToMatVector(mat, plans, features,
+            first->mNeedZMUNormalization, first->mNeedDownSampling,
+            first->mDownSamplingRatio, first->mDownSamplingMethod,
+            first->mChannelCombination, first->mMagnitudeMode,
+            first->mWorkspaces);
+}
+
 }
 
 #endif /* GABORFEATURESET_HPP_ */
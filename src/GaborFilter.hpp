@@ -36,6 +36,20 @@ namespace fex
 
 using namespace cv;
 
+/*
+ * Gabor filter generation methods.
+ *
+ * GABOR_SPATIAL_DOMAIN samples the kernel pixel by pixel and transforms it to
+ * get its spectrum. GABOR_FREQUENCY_DOMAIN writes the spectrum directly from
+ * its closed form, skipping both the spatial pass and the forward DFT; the
+ * spatial kernel is not generated in that case.
+ */
+enum
+{
+    GABOR_SPATIAL_DOMAIN = 0,
+    GABOR_FREQUENCY_DOMAIN = 1
+};
+
 /*
  ==============================================================================
  ==============================================================================
@@ -127,8 +141,8 @@ void GaborFilterBody<_Tp>::operator() (const BlockedRange& range ) const
 		commonPart = mKS * exp(mKSHalf * (magnitude));
 
 		complexTempResult =
-				(exp(1.0*i * ((mKReal * offsetYVal) + (mKImag * offsetXVal)))
-				- exp(-0.5 * mSSquare));
+				(exp(i * ((mKReal * offsetYVal) + (mKImag * offsetXVal)))
+				- exp(_Tp(-0.5) * mSSquare));
 
 		complexResult = commonPart * complexTempResult;
 
@@ -136,6 +150,119 @@ void GaborFilterBody<_Tp>::operator() (const BlockedRange& range ) const
 	}
 }
 
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                           GaborFilterFFTBody                             ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Template class for parallel Gabor filter spectrum initialization.
+ *
+ * The Fourier transform of a DC-compensated Gabor kernel is a closed-form
+ * pair of Gaussians, centred on the wave vector and on the origin:
+ *
+ *   2*pi * (exp(-s^2*|w-k|^2 / (2*k^2)) - exp(-s^2*(|w|^2+k^2) / (2*k^2)))
+ *
+ * Each DFT bin is mapped to its frequency in [-pi, pi) and multiplied by the
+ * linear phase that places the kernel centre at (offsetX, offsetY), as the
+ * spatial kernel is placed by ImageHelpers::complexDFT.
+ */
+template<typename _Tp> class GaborFilterFFTBody
+{
+public:
+
+	/*
+	 * Constructor
+	 */
+	GaborFilterFFTBody(int _dftSizeX, int _dftSizeY, int _offsetX,
+			int _offsetY, _Tp _kReal, _Tp _kImag, _Tp _kSquare,
+			_Tp _sSquare, Vec<_Tp, 2>* _data);
+
+	/*
+	 * TBB operator
+	 */
+	void operator() (const BlockedRange& range ) const;
+
+private:
+
+	/*
+	 * Input and output arguments
+	 */
+	Vec<_Tp, 2>* data;
+
+	/*
+	 * Arguments needed for computation
+	 */
+	int mDFTSizeX;
+	int mDFTSizeY;
+	int mOffsetX;
+	int mOffsetY;
+	_Tp mKReal;
+	_Tp mKImag;
+	_Tp mKSquare;
+	_Tp mSKHalf;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/*************
+ * Constructor
+ *************/
+template<typename _Tp>
+GaborFilterFFTBody<_Tp>::GaborFilterFFTBody(int _dftSizeX, int _dftSizeY,
+		int _offsetX, int _offsetY, _Tp _kReal, _Tp _kImag, _Tp _kSquare,
+		_Tp _sSquare, Vec<_Tp, 2>* _data) :
+		data(_data), mDFTSizeX(_dftSizeX), mDFTSizeY(_dftSizeY),
+		mOffsetX(_offsetX), mOffsetY(_offsetY), mKReal(_kReal),
+		mKImag(_kImag), mKSquare(_kSquare),
+		mSKHalf(_Tp(-0.5) * _sSquare / _kSquare) {}
+
+/**************
+ * TBB Operator
+ **************/
+template<typename _Tp>
+void GaborFilterFFTBody<_Tp>::operator() (const BlockedRange& range ) const
+{
+	const _Tp twoPi = _Tp(2 * M_PI);
+
+	int u;
+	int v;
+	_Tp wX;
+	_Tp wY;
+	_Tp dX;
+	_Tp dY;
+	_Tp magnitude;
+	_Tp phase;
+
+	for( int index=range.begin(); index!=range.end( ); ++index )
+	{
+		u = index/mDFTSizeY;
+		v = index%mDFTSizeY;
+
+		wX = (twoPi * ((u <= mDFTSizeX/2) ? u : u - mDFTSizeX)) / mDFTSizeX;
+		wY = (twoPi * ((v <= mDFTSizeY/2) ? v : v - mDFTSizeY)) / mDFTSizeY;
+
+		dX = wX - mKImag;
+		dY = wY - mKReal;
+
+		magnitude = twoPi * (exp(mSKHalf * (dX*dX + dY*dY)) -
+				exp(mSKHalf * (wX*wX + wY*wY + mKSquare)));
+
+		phase = -twoPi * ((_Tp(u) * mOffsetX) / mDFTSizeX +
+				(_Tp(v) * mOffsetY) / mDFTSizeY);
+
+		data[index] = Vec<_Tp, 2>(magnitude * cos(phase),
+				magnitude * sin(phase));
+	}
+}
+
 /*
  ==============================================================================
  ==============================================================================
@@ -165,9 +292,10 @@ public:
      */
     GaborFilter();
     GaborFilter(int _scale, int _orientation, int _filterSize,
-            _Tp _kMax, _Tp _sigma);
+            _Tp _kMax, _Tp _sigma, int _method = GABOR_SPATIAL_DOMAIN);
     GaborFilter(int _scale, int _orientation, int _filterSizeX,
-            int _filterSizeY, _Tp _kMax, _Tp _sigma);
+            int _filterSizeY, _Tp _kMax, _Tp _sigma,
+            int _method = GABOR_SPATIAL_DOMAIN);
     // TODO: New types of constructors, allow to create a filter from a
     // Mat object, a IPLImage, etc...
     virtual ~GaborFilter();
@@ -181,9 +309,37 @@ public:
     int getFilterSizeY() const;
     _Tp getKMax() const;
     _Tp getSigma() const;
+    int getMethod() const;
+    // Empty when the filter was generated with GABOR_FREQUENCY_DOMAIN
     Mat_<complex<_Tp> > getFilter() const;
     Mat_<Vec<_Tp, 2> > getFilterFFT() const;
 
+    /*
+     * Spectrum of the filter with its centre placed at (offsetX, offsetY) of
+     * a dftSizeX x dftSizeY frame. getFilterFFT() is the special case of a
+     * frame of the filter's own optimal DFT size and offsets of half the
+     * filter size.
+     */
+    void computeFilterFFT(Mat_<Vec<_Tp, 2> >& dst, int dftSizeX,
+            int dftSizeY, int offsetX, int offsetY) const;
+
+    /*
+     * Parameters of the recursive form of the filter, with its centre
+     * placed at (offsetX, offsetY). Available for both generation methods.
+     */
+    void computeRecursiveKernel(RecursiveGaborKernel& dst, int offsetX,
+            int offsetY) const;
+
+    /*
+     * Smallest odd kernel size holding all but a fraction tolerance of the
+     * energy of the Gaussian envelope of a filter of the given scale.
+     *
+     * The envelope has a standard deviation of sigma/k pixels, so its energy
+     * out of the (2h+1)^2 square is bounded by 2*exp(-(h*k/sigma)^2).
+     */
+    static int getSupportSize(int scale, _Tp kMax, _Tp sigma,
+            _Tp tolerance);
+
 private:
     /*
      * Attributes
@@ -194,6 +350,7 @@ private:
     int mFilterSizeY;
     _Tp mKMax;
     _Tp mSigma;
+    int mMethod;
     Mat_<complex<_Tp> > mFilter;
     Mat_<Vec<_Tp, 2> > mFilterFFT;
 
@@ -213,12 +370,17 @@ private:
     // init function to refactor code.
     void init(Mat_<complex<_Tp> >& result,
             Mat_<Vec<_Tp, 2> >& filterFFT, int scale, int orientation,
-            int filterSizeX, int filterSizeY, _Tp kMax, _Tp sigma);
+            int filterSizeX, int filterSizeY, _Tp kMax, _Tp sigma,
+            int method);
 
     void generateFilter(Mat_<complex<_Tp> >& result, int scale,
             int orientation, int filterSizeX, int filterSizeY, _Tp kMax,
             _Tp sigma);
 
+    void generateFilterFFT(Mat_<Vec<_Tp, 2> >& result, int scale,
+            int orientation, int dftSizeX, int dftSizeY, int offsetX,
+            int offsetY, _Tp kMax, _Tp sigma) const;
+
 };
 
 /******************************************************************************
@@ -241,18 +403,18 @@ template<typename _Tp> GaborFilter<_Tp>::GaborFilter()
 }
 
 template<typename _Tp> GaborFilter<_Tp>::GaborFilter(int _scale,
-        int _orientation, int _filterSize, _Tp _kMax, _Tp _sigma)
+        int _orientation, int _filterSize, _Tp _kMax, _Tp _sigma, int _method)
 {
     init(mFilter, mFilterFFT, _scale, _orientation, _filterSize, _filterSize,
-            _kMax, _sigma);
+            _kMax, _sigma, _method);
 }
 
 template<typename _Tp> GaborFilter<_Tp>::GaborFilter(int _scale,
         int _orientation, int _filterSizeX, int _filterSizeY, _Tp _kMax,
-        _Tp _sigma)
+        _Tp _sigma, int _method)
 {
     init(mFilter, mFilterFFT, _scale, _orientation, _filterSizeX, _filterSizeY,
-        _kMax, _sigma);
+        _kMax, _sigma, _method);
 }
 
 template<typename _Tp> GaborFilter<_Tp>::~GaborFilter()
@@ -299,6 +461,12 @@ inline _Tp GaborFilter<_Tp>::getSigma() const
     return (mSigma);
 }
 
+template<typename _Tp>
+inline int GaborFilter<_Tp>::getMethod() const
+{
+    return (mMethod);
+}
+
 template<typename _Tp> inline Mat_<complex<_Tp> >
 GaborFilter<_Tp>::getFilter() const
 {
@@ -311,22 +479,107 @@ GaborFilter<_Tp>::getFilterFFT() const
     return (mFilterFFT);
 }
 
+/*********
+ * Methods
+ *********/
+template<typename _Tp>
+void GaborFilter<_Tp>::computeFilterFFT(Mat_<Vec<_Tp, 2> >& dst,
+        int dftSizeX, int dftSizeY, int offsetX, int offsetY) const
+{
+    if(mMethod == GABOR_FREQUENCY_DOMAIN)
+    {
+        generateFilterFFT(dst, mScale, mOrientation, dftSizeX, dftSizeY,
+                offsetX, offsetY, mKMax, mSigma);
+        return;
+    }
+
+    int top = offsetX - mFilterSizeX/2;
+    int left = offsetY - mFilterSizeY/2;
+
+    if((top == 0) && (left == 0) && (dftSizeX == mFilterFFT.rows) &&
+            (dftSizeY == mFilterFFT.cols))
+    {
+        dst = mFilterFFT;
+        return;
+    }
+
+    CV_Assert((top >= 0) && (left >= 0) &&
+            (top + mFilterSizeX <= dftSizeX) &&
+            (left + mFilterSizeY <= dftSizeY));
+
+    Mat_<complex<_Tp> > placed;
+    copyMakeBorder(mFilter, placed, top, 0, left, 0, BORDER_CONSTANT,
+            Scalar::all(0));
+
+    ImageHelpers::complexDFT(placed, dst, Size(dftSizeY, dftSizeX));
+}
+
+template<typename _Tp>
+void GaborFilter<_Tp>::computeRecursiveKernel(RecursiveGaborKernel& dst,
+        int offsetX, int offsetY) const
+{
+    double psi = ((mOrientation*M_PI)/8);
+    double f = sqrt(2.0);
+    double k = mKMax/pow(f, mScale);
+
+    // Envelope exp(-k^2 |x|^2 / (2 sigma^2)) scaled by k^2/sigma^2 is a unit
+    // Gaussian of deviation sigma/k scaled by 2 pi.
+    dst.sigma = mSigma/k;
+    dst.omegaX = k*sin(psi);
+    dst.omegaY = k*cos(psi);
+    dst.dcTerm = exp(-0.5*mSigma*mSigma);
+    dst.gain = 2*M_PI;
+    dst.offsetX = offsetX;
+    dst.offsetY = offsetY;
+    ImageHelpers::recursiveGaussianCoefficients(dst.sigma, dst.coefficients);
+}
+
+template<typename _Tp>
+int GaborFilter<_Tp>::getSupportSize(int scale, _Tp kMax, _Tp sigma,
+        _Tp tolerance)
+{
+    CV_Assert((tolerance > 0) && (tolerance < 1));
+
+    double f = sqrt(2.0);
+    double k = kMax/pow(f, scale);
+    double halfSize = (sigma/k) * sqrt(std::log(2.0/tolerance));
+
+    return (2*cvCeil(halfSize) + 1);
+}
+
 /*******************
  * Private functions
  *******************/
 template<typename _Tp>
 void GaborFilter<_Tp>::init(Mat_<complex<_Tp> > & filter,
         Mat_<Vec<_Tp, 2> >& filterFFT, int scale, int orientation,
-        int filterSizeX, int filterSizeY, _Tp kMax, _Tp sigma)
+        int filterSizeX, int filterSizeY, _Tp kMax, _Tp sigma, int method)
 {
     GaborFilter<_Tp>::checkForFloatingPoint();
 
+    CV_Assert((method == GABOR_SPATIAL_DOMAIN) ||
+            (method == GABOR_FREQUENCY_DOMAIN));
+
     mScale = scale;
     mOrientation = orientation;
     mFilterSizeX = filterSizeX;
     mFilterSizeY = filterSizeY;
     mKMax = kMax;
     mSigma = sigma;
+    mMethod = method;
+
+    if(mMethod == GABOR_FREQUENCY_DOMAIN)
+    {
+        // We write the dft directly from its closed form, with the same
+        // anchor and DFT size ImageHelpers::complexDFT would use for the
+        // spatial kernel, so both methods give interchangeable spectra.
+        generateFilterFFT(mFilterFFT, mScale, mOrientation,
+                getOptimalDFTSize(mFilterSizeX),
+                getOptimalDFTSize(mFilterSizeY), mFilterSizeX/2,
+                mFilterSizeY/2, mKMax, mSigma);
+        return;
+    }
+
     // We generate the filter
     generateFilter(mFilter, mScale, mOrientation, mFilterSizeX,
             mFilterSizeY, mKMax, mSigma);
@@ -366,6 +619,29 @@ void GaborFilter<_Tp>::generateFilter(Mat_<complex<_Tp> > & result,
 
 }
 
+template<typename _Tp>
+void GaborFilter<_Tp>::generateFilterFFT(Mat_<Vec<_Tp, 2> >& result,
+        int scale, int orientation, int dftSizeX, int dftSizeY, int offsetX,
+        int offsetY, _Tp kMax, _Tp sigma) const
+{
+	_Tp psi = ((orientation*M_PI)/8);
+	_Tp f = sqrt(2.0);
+	_Tp fV = pow(f, scale);
+	_Tp kReal = (kMax/fV)*cos(psi);
+	_Tp kImag = (kMax/fV)*sin(psi);
+	_Tp kSquare = kReal*kReal + kImag*kImag;
+	_Tp sSquare = sigma*sigma;
+
+	result.create(dftSizeX, dftSizeY);
+
+	Vec<_Tp, 2>* data = ((Mat)result).ptr<Vec<_Tp, 2> >(0);
+
+	GaborFilterFFTBody<_Tp> gaborFilterFFTBody(dftSizeX, dftSizeY, offsetX,
+			offsetY, kReal, kImag, kSquare, sSquare, data);
+
+	parallel_for(BlockedRange(0, dftSizeX*dftSizeY), gaborFilterFFTBody);
+}
+
 }
 
 #endif /* GABORFILTER_HPP_ */
@@ -0,0 +1,1091 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef GABORFILTERINGPLAN_HPP_
+#define GABORFILTERINGPLAN_HPP_
+
+// TODO: Check really needed header files, including all OpenCV headers
+// is way too much
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/internal.hpp"
+#include "ImageHelpers.hpp"
+#include "FilterBank.hpp"
+#include "GaborSet.hpp"
+#include "GaborFilter.hpp"
+#include "MappedFile.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+
+namespace fex
+{
+
+using namespace cv;
+
+/*
+ * On-disk layout of a filtering plan, written by GaborFilteringPlan::save.
+ *
+ * The header is followed, at a page aligned offset, by the filter spectra
+ * in filter order. Each spectrum is stored row after row as interleaved
+ * (real, imaginary) pairs in native byte order, and consecutive spectra are
+ * filterStride bytes apart so that each of them starts on a cache line.
+ *
+ * The header also holds where the filter centres are placed in the DFT
+ * frame and where the responses of the image start, so a loaded plan crops
+ * its responses as the plan it was saved from.
+ *
+ * Since version 2, a non zero spectrumTypesOffset locates a table of one
+ * byte per filter, set for the filters whose spectrum is the CCS packed
+ * half spectrum of a real kernel (dftRows x dftCols values) instead of a
+ * complex one.
+ */
+struct GaborFilteringPlanHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t headerSize;
+    int32_t depth;
+    int32_t numFilters;
+    int32_t scales;
+    int32_t orientations;
+    int32_t filterSizeX;
+    int32_t filterSizeY;
+    int32_t startAtScaleZero;
+    int32_t method;
+    int32_t imageRows;
+    int32_t imageCols;
+    int32_t dftRows;
+    int32_t dftCols;
+    int32_t filterCentreRow;
+    int32_t filterCentreCol;
+    int32_t responseRow;
+    int32_t responseCol;
+    int32_t spectrumTypesOffset;
+    double kMax;
+    double sigma;
+    uint64_t dataOffset;
+    uint64_t filterStride;
+};
+
+/*
+ * Filtering backends.
+ *
+ * FILTERING_FFT multiplies spectra and runs an inverse DFT per filter.
+ * FILTERING_DIRECT convolves in the spatial domain with the low-rank
+ * separable form of each kernel. FILTERING_AUTO picks, for each filter, the
+ * one with the lower estimated cost for the plan geometry.
+ *
+ * FILTERING_RECURSIVE filters with recursive Gaussians, at a cost per pixel
+ * that does not depend on sigma or on the kernel size. It only approximates
+ * the other two, so FILTERING_AUTO never picks it: it has to be requested.
+ */
+enum
+{
+    FILTERING_FFT = 0,
+    FILTERING_DIRECT = 1,
+    FILTERING_AUTO = 2,
+    FILTERING_RECURSIVE = 3
+};
+
+const char GABOR_PLAN_MAGIC[8] = {'L', 'I', 'B', 'F', 'E', 'X', 'G', 'P'};
+const uint32_t GABOR_PLAN_VERSION = 2;
+const uint32_t GABOR_PLAN_BYTE_ORDER = 0x01020304;
+const int GABOR_PLAN_DATA_ALIGNMENT = 4096;
+const int GABOR_PLAN_FILTER_ALIGNMENT = 64;
+// Relative error allowed in the separable form of FILTERING_DIRECT kernels
+const double GABOR_PLAN_SEPARABLE_TOLERANCE = 1e-6;
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                         GaborFilteringPlanBody                           ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+template<typename _Tp> class GaborFilteringPlan;
+
+/*
+ * Template class for parallel filtering plan initialization.
+ *
+ * Without spectrumSlots it selects the backend of each filter and computes
+ * its spatial form. With them, it only computes the spectra of the filters
+ * that have a slot, into that slot of the spectra buffer.
+ */
+template<typename _Tp> class GaborFilteringPlanBody
+{
+public:
+
+	/*
+	 * Constructor
+	 */
+	GaborFilteringPlanBody(const FilterBank<_Tp>* _filterBank, int _backend,
+			Size _imageSize, int _dftSizeX, int _dftSizeY, int _offsetX,
+			int _offsetY, int _originX, int _originY, uchar* _spectra,
+			size_t _filterStride, const int* _spectrumSlots,
+			SeparableKernel<_Tp>* _separableData,
+			RecursiveGaborKernel* _recursiveData, uchar* _realSpectra,
+			int* _backends);
+
+	/*
+	 * TBB operator
+	 */
+	void operator() (const BlockedRange& range ) const;
+
+private:
+
+	/*
+	 * Input and output arguments
+	 */
+	const FilterBank<_Tp>* filterBank;
+	uchar* spectra;
+	const int* spectrumSlots;
+	SeparableKernel<_Tp>* separableData;
+	RecursiveGaborKernel* recursiveData;
+	uchar* realSpectra;
+	int* backends;
+
+	/*
+	 * Arguments needed for computation
+	 */
+	int mBackend;
+	Size mImageSize;
+	int mDFTSizeX;
+	int mDFTSizeY;
+	int mOffsetX;
+	int mOffsetY;
+	// Frame position of the response of the first image pixel
+	int mOriginX;
+	int mOriginY;
+	size_t mFilterStride;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/*************
+ * Constructor
+ *************/
+template<typename _Tp>
+GaborFilteringPlanBody<_Tp>::GaborFilteringPlanBody(
+		const FilterBank<_Tp>* _filterBank, int _backend, Size _imageSize,
+		int _dftSizeX, int _dftSizeY, int _offsetX, int _offsetY,
+		int _originX, int _originY, uchar* _spectra, size_t _filterStride,
+		const int* _spectrumSlots, SeparableKernel<_Tp>* _separableData,
+		RecursiveGaborKernel* _recursiveData, uchar* _realSpectra,
+		int* _backends) :
+		filterBank(_filterBank), spectra(_spectra),
+		spectrumSlots(_spectrumSlots), separableData(_separableData),
+		recursiveData(_recursiveData), realSpectra(_realSpectra),
+		backends(_backends), mBackend(_backend), mImageSize(_imageSize),
+		mDFTSizeX(_dftSizeX), mDFTSizeY(_dftSizeY), mOffsetX(_offsetX),
+		mOffsetY(_offsetY), mOriginX(_originX), mOriginY(_originY),
+		mFilterStride(_filterStride) {}
+
+/**************
+ * TBB Operator
+ **************/
+template<typename _Tp>
+void GaborFilteringPlanBody<_Tp>::operator() (
+		const BlockedRange& range ) const
+{
+	int backend;
+	Mat_<complex<_Tp> > kernel;
+	Mat_<Vec<_Tp, 2> > spectrum;
+	Mat_<_Tp> realSpectrum;
+
+	// Spatial responses are written at the image pixels, so their kernels
+	// are moved as the crop of the FFT responses moves them
+	int spatialOffsetX = mOffsetX - mOriginX;
+	int spatialOffsetY = mOffsetY - mOriginY;
+
+	for( int index=range.begin(); index!=range.end( ); ++index )
+	{
+		if(spectrumSlots != 0)
+		{
+			if(spectrumSlots[index] < 0)
+			{
+				continue;
+			}
+
+			// Half spectra of real kernels only fill half of their slot
+			uchar* slot = spectra + spectrumSlots[index]*mFilterStride;
+			if(realSpectra[index] != 0)
+			{
+				filterBank->computeRealKernelFFT(index, realSpectrum,
+						mDFTSizeX, mDFTSizeY, mOffsetX, mOffsetY);
+				Mat_<_Tp> slotSpectrum(mDFTSizeX, mDFTSizeY, (_Tp*)slot);
+				((Mat)realSpectrum).copyTo(slotSpectrum);
+			}
+			else {
+				filterBank->computeKernelFFT(index, spectrum, mDFTSizeX,
+						mDFTSizeY, mOffsetX, mOffsetY);
+				Mat_<Vec<_Tp, 2> > slotSpectrum(mDFTSizeX, mDFTSizeY,
+						(Vec<_Tp, 2>*)slot);
+				((Mat)spectrum).copyTo(slotSpectrum);
+			}
+			continue;
+		}
+
+		backend = mBackend;
+
+		if(backend == FILTERING_RECURSIVE)
+		{
+			filterBank->computeRecursiveKernel(index, recursiveData[index],
+					spatialOffsetX, spatialOffsetY);
+			backends[index] = backend;
+			continue;
+		}
+
+		// Filters defined in the frequency domain have no spatial kernel
+		// to decompose.
+		kernel = filterBank->getKernel(index);
+		if(kernel.empty())
+		{
+			backend = FILTERING_FFT;
+		}
+
+		if(backend != FILTERING_FFT)
+		{
+			ImageHelpers::separableDecomposition(kernel,
+					separableData[index], GABOR_PLAN_SEPARABLE_TOLERANCE,
+					spatialOffsetX - kernel.rows/2,
+					spatialOffsetY - kernel.cols/2);
+		}
+
+		if(backend == FILTERING_AUTO)
+		{
+			backend = (GaborFilteringPlan<_Tp>::directCost(mImageSize,
+					separableData[index]) <
+					GaborFilteringPlan<_Tp>::fftCost(
+					Size(mDFTSizeY, mDFTSizeX))) ?
+					FILTERING_DIRECT : FILTERING_FFT;
+		}
+
+		realSpectra[index] = 0;
+		if(backend == FILTERING_FFT)
+		{
+			separableData[index] = SeparableKernel<_Tp>();
+			realSpectra[index] = filterBank->isRealKernel(index) ? 1 : 0;
+		}
+
+		backends[index] = backend;
+	}
+}
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                           GaborFilteringPlan                             ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Template class for a filter bank bound to an input geometry. Any
+ * FilterBank can be planned; the Gabor parameters (scales, orientations,
+ * kMax, sigma...) are only set for plans of a GaborSet, and are zero
+ * otherwise.
+ *
+ * Every filter spectrum is computed once at an optimal DFT size for the
+ * input images, so kernels no longer need to be generated at the padded
+ * image size. The filter centres are placed at getFilterCentre() of the
+ * frame, and the frame leaves that much room past the image, so that the
+ * responses cropped at getResponseArea() are the linear convolution
+ * centred on each image pixel, free of wrap-around.
+ *
+ * Filters of the image size, whose optimal DFT size is the image size,
+ * keep the circular filtering of the original pipeline instead: their
+ * centres are anchored as ImageHelpers::complexDFT anchors them, giving the
+ * same spectra as GaborFilter::getFilterFFT(), and the whole inverse
+ * transforms are the responses.
+ *
+ * The spectra of the filters using FILTERING_FFT live in a single buffer,
+ * one after the other in filter order and filterStride bytes apart so that
+ * each of them starts on a cache line, which is also the layout of saved
+ * plans. Plans built with reducedSpectra also keep a single precision copy
+ * of the complex spectra, for double plans, which halves the bandwidth of
+ * the spectrum products.
+ *
+ * Real kernels (FilterBank::isRealKernel) keep the CCS packed half spectrum
+ * instead, which halves both the spectrum and its product with the image.
+ *
+ * Plans for responses downsampled in the frequency domain (see
+ * DOWNSAMPLING_FOLD) take the downsampling step, and round the DFT size and
+ * the filter centre up to a multiple of it.
+ *
+ * minDFTSize raises the size the spectra are computed at. Plans of several
+ * banks built for the same images, step and minDFTSize (at least the
+ * largest computeDFTSize() of the banks) share their DFT size, so they can
+ * filter the same image spectrum.
+ *
+ * Plans are immutable once built, and copies share their spectra.
+ */
+template<typename _Tp> class GaborFilteringPlan
+{
+public:
+	/*
+	 * Typedefs
+	 */
+	typedef _Tp value_type;
+
+	/*
+	 * Constructors
+	 */
+	GaborFilteringPlan();
+	GaborFilteringPlan(const FilterBank<_Tp>& filterBank, Size imageSize,
+			int backend = FILTERING_FFT, bool reducedSpectra = false,
+			int downSamplingStep = 1, Size minDFTSize = Size());
+	virtual ~GaborFilteringPlan();
+
+	/*
+	 * Persistence.
+	 *
+	 * load() maps the file read-only instead of reading it, so every process
+	 * loading the same file shares a single copy of the spectra. The mapping
+	 * is released with the last copy of the plan. Only plans whose filters
+	 * all use FILTERING_FFT can be saved.
+	 */
+	void save(const string& filename) const;
+	static GaborFilteringPlan<_Tp> load(const string& filename);
+
+	/*
+	 * Attribute getters
+	 */
+	bool empty() const;
+	int getScales() const;
+	int getOrientations() const;
+	int getFilterSizeX() const;
+	int getFilterSizeY() const;
+	_Tp getKMax() const;
+	_Tp getSigma() const;
+	bool isStartAtScaleZero() const;
+	int getMethod() const;
+	int getNumFilters() const;
+	Size getImageSize() const;
+	Size getDFTSize() const;
+	// Position of the filter centres in the DFT frame, and area of the
+	// inverse transforms holding the responses of the image pixels
+	Point getFilterCentre() const;
+	Rect getResponseArea() const;
+	// Backend selected for each filter, never FILTERING_AUTO
+	int getBackend(int index) const;
+	bool hasBackend(int backend) const;
+	// Only set for the filters using FILTERING_FFT. The headers returned
+	// point into the plan buffer, they are only valid with the plan.
+	Mat_<Vec<_Tp, 2> > getFilterFFT(int index) const;
+	const Vec<_Tp, 2>* getFilterFFTPtr(int index) const;
+	size_t getFilterStride() const;
+	// Only set for double plans built with reducedSpectra
+	bool hasReducedSpectra() const;
+	const Vec2f* getReducedFilterFFTPtr(int index) const;
+	// FILTERING_FFT filters with a real kernel keep its half spectrum in
+	// their slot instead of the complex one
+	bool isRealSpectrum(int index) const;
+	bool hasRealSpectra() const;
+	bool hasComplexSpectra() const;
+	Mat_<_Tp> getRealFilterFFT(int index) const;
+	const _Tp* getRealFilterFFTPtr(int index) const;
+	// Only set for the filters using FILTERING_DIRECT
+	const SeparableKernel<_Tp>& getSeparableKernel(int index) const;
+	// Only set for the filters using FILTERING_RECURSIVE
+	const RecursiveGaborKernel& getRecursiveKernel(int index) const;
+
+	/*
+	 * Cost estimates, in multiply-adds per filter and image, used by
+	 * FILTERING_AUTO. The forward DFT of the image is shared by every
+	 * filter, so it is not charged to any of them.
+	 */
+	static double fftCost(Size dftSize);
+	static double directCost(Size imageSize,
+			const SeparableKernel<_Tp>& kernel);
+
+	/*
+	 * DFT size of a plan of a bank, without building it
+	 */
+	static Size computeDFTSize(const FilterBank<_Tp>& filterBank,
+			Size imageSize, int downSamplingStep = 1,
+			Size minDFTSize = Size());
+
+private:
+	/*
+	 * Attributes
+	 */
+	int mNumFilters;
+	int mScales;
+	int mOrientations;
+	int mFilterSizeX;
+	int mFilterSizeY;
+	_Tp mKMax;
+	_Tp mSigma;
+	bool mStartAtScaleZero;
+	int mMethod;
+	Size mImageSize;
+	Size mDFTSize;
+	Point mFilterCentre;
+	Point mResponseOrigin;
+	// Spectra of the FFT filters, owned by mSpectraStorage or by
+	// mMappedFile, and slot of each filter in it (-1 for the others)
+	Mat mSpectraStorage;
+	uchar* mSpectra;
+	size_t mFilterStride;
+	vector<int> mSpectrumSlots;
+	// Same for the reduced copies of the complex spectra
+	Mat mReducedSpectraStorage;
+	uchar* mReducedSpectra;
+	size_t mReducedFilterStride;
+	vector<int> mReducedSlots;
+	vector<SeparableKernel<_Tp> > mSeparableKernels;
+	vector<RecursiveGaborKernel> mRecursiveKernels;
+	vector<uchar> mRealSpectra;
+	vector<int> mBackends;
+	// Set when the spectra point into a mapped file
+	Ptr<MappedFile> mMappedFile;
+
+	/*
+	 * Private functions
+	 */
+	void init(const FilterBank<_Tp>& filterBank, Size imageSize,
+			int backend, bool reducedSpectra, int downSamplingStep,
+			Size minDFTSize);
+
+	// Optimal DFT size not below size that is a multiple of step
+	static int getOptimalDFTSize(int size, int step);
+
+	// DFT size, filter centre and response origin of a plan geometry
+	static void computeGeometry(Size filterSize, Size imageSize,
+			int downSamplingStep, Size minDFTSize, Size& dftSize,
+			Point& filterCentre, Point& responseOrigin);
+
+	static uchar* allocateSpectra(Mat& storage, int numFilters,
+			size_t filterStride);
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/**************
+ * Constructors
+ **************/
+template<typename _Tp> GaborFilteringPlan<_Tp>::GaborFilteringPlan() :
+		mNumFilters(0), mSpectra(0), mFilterStride(0), mReducedSpectra(0),
+		mReducedFilterStride(0)
+{
+}
+
+template<typename _Tp> GaborFilteringPlan<_Tp>::GaborFilteringPlan(
+		const FilterBank<_Tp>& filterBank, Size imageSize, int backend,
+		bool reducedSpectra, int downSamplingStep, Size minDFTSize)
+{
+	init(filterBank, imageSize, backend, reducedSpectra, downSamplingStep,
+			minDFTSize);
+}
+
+template<typename _Tp> GaborFilteringPlan<_Tp>::~GaborFilteringPlan()
+{
+}
+
+/*******************
+ * Attribute getters
+ *******************/
+template<typename _Tp>
+inline bool GaborFilteringPlan<_Tp>::empty() const
+{
+	return (mNumFilters == 0);
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getScales() const
+{
+	return (mScales);
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getOrientations() const
+{
+	return (mOrientations);
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getFilterSizeX() const
+{
+	return (mFilterSizeX);
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getFilterSizeY() const
+{
+	return (mFilterSizeY);
+}
+
+template<typename _Tp>
+inline _Tp GaborFilteringPlan<_Tp>::getKMax() const
+{
+	return (mKMax);
+}
+
+template<typename _Tp>
+inline _Tp GaborFilteringPlan<_Tp>::getSigma() const
+{
+	return (mSigma);
+}
+
+template<typename _Tp>
+inline bool GaborFilteringPlan<_Tp>::isStartAtScaleZero() const
+{
+	return (mStartAtScaleZero);
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getMethod() const
+{
+	return (mMethod);
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getNumFilters() const
+{
+	return (mNumFilters);
+}
+
+template<typename _Tp>
+inline Size GaborFilteringPlan<_Tp>::getImageSize() const
+{
+	return (mImageSize);
+}
+
+template<typename _Tp>
+inline Size GaborFilteringPlan<_Tp>::getDFTSize() const
+{
+	return (mDFTSize);
+}
+
+template<typename _Tp>
+inline Point GaborFilteringPlan<_Tp>::getFilterCentre() const
+{
+	return (mFilterCentre);
+}
+
+template<typename _Tp>
+inline Rect GaborFilteringPlan<_Tp>::getResponseArea() const
+{
+	return (Rect(mResponseOrigin, mImageSize));
+}
+
+template<typename _Tp>
+inline int GaborFilteringPlan<_Tp>::getBackend(int index) const
+{
+	return (mBackends[index]);
+}
+
+template<typename _Tp>
+bool GaborFilteringPlan<_Tp>::hasBackend(int backend) const
+{
+	return (find(mBackends.begin(), mBackends.end(), backend) !=
+			mBackends.end());
+}
+
+template<typename _Tp>
+inline Mat_<Vec<_Tp, 2> >
+GaborFilteringPlan<_Tp>::getFilterFFT(int index) const
+{
+	return (Mat_<Vec<_Tp, 2> >(mDFTSize.height, mDFTSize.width,
+			(Vec<_Tp, 2>*)getFilterFFTPtr(index)));
+}
+
+template<typename _Tp>
+inline const Vec<_Tp, 2>*
+GaborFilteringPlan<_Tp>::getFilterFFTPtr(int index) const
+{
+	return ((const Vec<_Tp, 2>*)(mSpectra +
+			mSpectrumSlots[index]*mFilterStride));
+}
+
+template<typename _Tp>
+inline size_t GaborFilteringPlan<_Tp>::getFilterStride() const
+{
+	return (mFilterStride);
+}
+
+template<typename _Tp>
+inline bool GaborFilteringPlan<_Tp>::hasReducedSpectra() const
+{
+	return (mReducedSpectra != 0);
+}
+
+template<typename _Tp>
+inline const Vec2f*
+GaborFilteringPlan<_Tp>::getReducedFilterFFTPtr(int index) const
+{
+	return ((const Vec2f*)(mReducedSpectra +
+			mReducedSlots[index]*mReducedFilterStride));
+}
+
+template<typename _Tp>
+inline bool GaborFilteringPlan<_Tp>::isRealSpectrum(int index) const
+{
+	return ((mBackends[index] == FILTERING_FFT) && (mRealSpectra[index] != 0));
+}
+
+template<typename _Tp>
+bool GaborFilteringPlan<_Tp>::hasRealSpectra() const
+{
+	for(int i=0; i<mNumFilters; i++)
+	{
+		if(isRealSpectrum(i))
+		{
+			return (true);
+		}
+	}
+	return (false);
+}
+
+template<typename _Tp>
+bool GaborFilteringPlan<_Tp>::hasComplexSpectra() const
+{
+	for(int i=0; i<mNumFilters; i++)
+	{
+		if((mBackends[i] == FILTERING_FFT) && !isRealSpectrum(i))
+		{
+			return (true);
+		}
+	}
+	return (false);
+}
+
+template<typename _Tp>
+inline Mat_<_Tp> GaborFilteringPlan<_Tp>::getRealFilterFFT(int index) const
+{
+	return (Mat_<_Tp>(mDFTSize.height, mDFTSize.width,
+			(_Tp*)getRealFilterFFTPtr(index)));
+}
+
+template<typename _Tp>
+inline const _Tp* GaborFilteringPlan<_Tp>::getRealFilterFFTPtr(int index) const
+{
+	return ((const _Tp*)(mSpectra + mSpectrumSlots[index]*mFilterStride));
+}
+
+template<typename _Tp>
+inline const SeparableKernel<_Tp>&
+GaborFilteringPlan<_Tp>::getSeparableKernel(int index) const
+{
+	return (mSeparableKernels[index]);
+}
+
+template<typename _Tp>
+inline const RecursiveGaborKernel&
+GaborFilteringPlan<_Tp>::getRecursiveKernel(int index) const
+{
+	return (mRecursiveKernels[index]);
+}
+
+/******************
+ * Cost estimations
+ ******************/
+template<typename _Tp>
+double GaborFilteringPlan<_Tp>::fftCost(Size dftSize)
+{
+	// Complex spectrum product plus a radix-2 inverse transform
+	double area = dftSize.area();
+	return (area * (4 + 2.5 * std::log(area) / std::log(2.0)));
+}
+
+template<typename _Tp>
+double GaborFilteringPlan<_Tp>::directCost(Size imageSize,
+		const SeparableKernel<_Tp>& kernel)
+{
+	// A vertical and a horizontal pass per term
+	return ((double)imageSize.area() * kernel.getNumTerms() *
+			(kernel.sizeX + kernel.sizeY));
+}
+
+/*************
+ * Persistence
+ *************/
+template<typename _Tp>
+void GaborFilteringPlan<_Tp>::save(const string& filename) const
+{
+	CV_Assert(!empty() && !hasBackend(FILTERING_DIRECT) &&
+			!hasBackend(FILTERING_RECURSIVE));
+
+	GaborFilteringPlanHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GABOR_PLAN_MAGIC, sizeof(header.magic));
+	header.version = GABOR_PLAN_VERSION;
+	header.byteOrder = GABOR_PLAN_BYTE_ORDER;
+	header.headerSize = sizeof(header);
+	header.depth = DataType<_Tp>::depth;
+	header.numFilters = mNumFilters;
+	header.scales = mScales;
+	header.orientations = mOrientations;
+	header.filterSizeX = mFilterSizeX;
+	header.filterSizeY = mFilterSizeY;
+	header.startAtScaleZero = mStartAtScaleZero;
+	header.method = mMethod;
+	header.imageRows = mImageSize.height;
+	header.imageCols = mImageSize.width;
+	header.dftRows = mDFTSize.height;
+	header.dftCols = mDFTSize.width;
+	header.filterCentreRow = mFilterCentre.y;
+	header.filterCentreCol = mFilterCentre.x;
+	header.responseRow = mResponseOrigin.y;
+	header.responseCol = mResponseOrigin.x;
+	header.kMax = mKMax;
+	header.sigma = mSigma;
+	header.spectrumTypesOffset = sizeof(header);
+	header.dataOffset = alignSize(sizeof(header) + mNumFilters,
+			GABOR_PLAN_DATA_ALIGNMENT);
+	header.filterStride = mFilterStride;
+
+	ofstream file(filename.c_str(), ios::out | ios::binary | ios::trunc);
+	if(!file)
+	{
+		CV_Error(CV_StsError, "Could not create " + filename);
+	}
+
+	vector<char> padding(header.dataOffset - sizeof(header) - mNumFilters, 0);
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&mRealSpectra.front(), mNumFilters);
+	file.write(&padding.front(), padding.size());
+	// The plan buffer already has the file layout
+	file.write((const char*)mSpectra, mNumFilters * mFilterStride);
+
+	if(!file)
+	{
+		CV_Error(CV_StsError, "Could not write " + filename);
+	}
+}
+
+template<typename _Tp>
+GaborFilteringPlan<_Tp> GaborFilteringPlan<_Tp>::load(const string& filename)
+{
+	Ptr<MappedFile> mappedFile = new MappedFile(filename);
+	const uchar* data = mappedFile->getData();
+
+	GaborFilteringPlanHeader header;
+	if(mappedFile->getSize() < sizeof(header))
+	{
+		CV_Error(CV_StsError, filename + " is not a filtering plan");
+	}
+	memcpy(&header, data, sizeof(header));
+
+	if(memcmp(header.magic, GABOR_PLAN_MAGIC, sizeof(header.magic)) != 0)
+	{
+		CV_Error(CV_StsError, filename + " is not a filtering plan");
+	}
+	// Version 1 plans only differ in having no spectrum types table
+	if((header.version < 1) || (header.version > GABOR_PLAN_VERSION) ||
+			(header.byteOrder != GABOR_PLAN_BYTE_ORDER) ||
+			(header.headerSize != sizeof(header)))
+	{
+		CV_Error(CV_StsUnsupportedFormat, filename +
+				" was written by an incompatible version or platform");
+	}
+	if(header.depth != DataType<_Tp>::depth)
+	{
+		CV_Error(CV_StsUnsupportedFormat, filename +
+				" does not hold spectra of the requested type");
+	}
+
+	uint64_t fileSize = mappedFile->getSize();
+	if((header.numFilters <= 0) || (header.filterSizeX <= 0) ||
+			(header.filterSizeY <= 0) || (header.imageRows <= 0) ||
+			(header.imageCols <= 0) || (header.dftRows <= 0) ||
+			(header.dftCols <= 0) ||
+			((header.spectrumTypesOffset != 0) &&
+			(header.spectrumTypesOffset < (int32_t)sizeof(header))) ||
+			(header.dataOffset % GABOR_PLAN_FILTER_ALIGNMENT != 0) ||
+			(header.dataOffset > fileSize))
+	{
+		CV_Error(CV_StsError, filename + " is truncated or corrupted");
+	}
+
+	// Sizes are bounded by the data in the file before being multiplied,
+	// so none of the products can overflow
+	uint64_t dataSize = fileSize - header.dataOffset;
+	uint64_t spectrumArea = (uint64_t)header.dftRows * header.dftCols;
+	if((spectrumArea > dataSize / sizeof(Vec<_Tp, 2>)) ||
+			(header.filterStride < spectrumArea * sizeof(Vec<_Tp, 2>)) ||
+			(header.filterStride % GABOR_PLAN_FILTER_ALIGNMENT != 0) ||
+			(header.filterStride > dataSize / header.numFilters) ||
+			((header.spectrumTypesOffset != 0) &&
+			((uint64_t)header.spectrumTypesOffset + header.numFilters >
+			header.dataOffset)))
+	{
+		CV_Error(CV_StsError, filename + " is truncated or corrupted");
+	}
+	// The responses of the image lie inside the frame
+	if((header.responseRow < 0) || (header.responseCol < 0) ||
+			(header.responseRow > header.dftRows - header.imageRows) ||
+			(header.responseCol > header.dftCols - header.imageCols) ||
+			(header.filterCentreRow < 0) || (header.filterCentreCol < 0) ||
+			(header.filterCentreRow >= header.dftRows) ||
+			(header.filterCentreCol >= header.dftCols))
+	{
+		CV_Error(CV_StsError, filename + " is truncated or corrupted");
+	}
+
+	GaborFilteringPlan<_Tp> plan;
+	plan.mNumFilters = header.numFilters;
+	plan.mScales = header.scales;
+	plan.mOrientations = header.orientations;
+	plan.mFilterSizeX = header.filterSizeX;
+	plan.mFilterSizeY = header.filterSizeY;
+	plan.mKMax = header.kMax;
+	plan.mSigma = header.sigma;
+	plan.mStartAtScaleZero = (header.startAtScaleZero != 0);
+	plan.mMethod = header.method;
+	plan.mImageSize = Size(header.imageCols, header.imageRows);
+	plan.mDFTSize = Size(header.dftCols, header.dftRows);
+	plan.mFilterCentre = Point(header.filterCentreCol, header.filterCentreRow);
+	plan.mResponseOrigin = Point(header.responseCol, header.responseRow);
+	plan.mMappedFile = mappedFile;
+	// The mapping is read-only, spectra are only exposed as const
+	plan.mSpectra = (uchar*)(data + header.dataOffset);
+	plan.mFilterStride = header.filterStride;
+	plan.mSpectrumSlots.resize(plan.mNumFilters);
+	for(int i=0; i<plan.mNumFilters; i++)
+	{
+		plan.mSpectrumSlots[i] = i;
+	}
+	plan.mReducedSlots.assign(plan.mNumFilters, -1);
+	plan.mSeparableKernels.resize(plan.mNumFilters);
+	plan.mRecursiveKernels.resize(plan.mNumFilters);
+	plan.mRealSpectra.assign(plan.mNumFilters, 0);
+	if(header.spectrumTypesOffset != 0)
+	{
+		memcpy(&plan.mRealSpectra.front(), data + header.spectrumTypesOffset,
+				plan.mNumFilters);
+	}
+	plan.mBackends.assign(plan.mNumFilters, FILTERING_FFT);
+
+	return (plan);
+}
+
+/*******************
+ * Private functions
+ *******************/
+template<typename _Tp>
+void GaborFilteringPlan<_Tp>::init(const FilterBank<_Tp>& filterBank,
+		Size imageSize, int backend, bool reducedSpectra,
+		int downSamplingStep, Size minDFTSize)
+{
+	CV_Assert((backend == FILTERING_FFT) || (backend == FILTERING_DIRECT) ||
+			(backend == FILTERING_AUTO) || (backend == FILTERING_RECURSIVE));
+	CV_Assert((backend != FILTERING_RECURSIVE) ||
+			filterBank.hasRecursiveForm());
+	CV_Assert(filterBank.getNumFilters() > 0);
+
+	int filterSizeX = filterBank.getFilterSizeX();
+	int filterSizeY = filterBank.getFilterSizeY();
+
+	mNumFilters = filterBank.getNumFilters();
+	mFilterSizeX = filterSizeX;
+	mFilterSizeY = filterSizeY;
+
+	const GaborSet<_Tp>* filterSet =
+			dynamic_cast<const GaborSet<_Tp>*>(&filterBank);
+	if(filterSet != 0)
+	{
+		mScales = filterSet->getScales();
+		mOrientations = filterSet->getOrientations();
+		mKMax = filterSet->getKMax();
+		mSigma = filterSet->getSigma();
+		mStartAtScaleZero = filterSet->isStartAtScaleZero();
+		mMethod = filterSet->getMethod();
+	}
+	else {
+		mScales = 0;
+		mOrientations = 0;
+		mKMax = 0;
+		mSigma = 0;
+		mStartAtScaleZero = false;
+		mMethod = 0;
+	}
+	mImageSize = imageSize;
+	computeGeometry(Size(filterSizeY, filterSizeX), imageSize,
+			downSamplingStep, minDFTSize, mDFTSize, mFilterCentre,
+			mResponseOrigin);
+	mSeparableKernels.resize(mNumFilters);
+	mRecursiveKernels.resize(mNumFilters);
+	mRealSpectra.assign(mNumFilters, 0);
+	mBackends.resize(mNumFilters);
+
+	// Backends are selected first, so that the plan buffer only holds the
+	// spectra of the filters using FILTERING_FFT
+	GaborFilteringPlanBody<_Tp> selectionBody(&filterBank, backend,
+			imageSize, mDFTSize.height, mDFTSize.width, mFilterCentre.y,
+			mFilterCentre.x, mResponseOrigin.y, mResponseOrigin.x, 0, 0, 0,
+			&mSeparableKernels.front(), &mRecursiveKernels.front(),
+			&mRealSpectra.front(), &mBackends.front());
+
+	parallel_for(BlockedRange(0, mNumFilters), selectionBody);
+
+	int numSpectra = 0;
+	int numComplexSpectra = 0;
+	mSpectrumSlots.assign(mNumFilters, -1);
+	mReducedSlots.assign(mNumFilters, -1);
+	for(int i=0; i<mNumFilters; i++)
+	{
+		if(mBackends[i] != FILTERING_FFT)
+		{
+			continue;
+		}
+		mSpectrumSlots[i] = numSpectra++;
+		if(mRealSpectra[i] == 0)
+		{
+			mReducedSlots[i] = numComplexSpectra++;
+		}
+	}
+
+	mSpectra = 0;
+	mFilterStride = 0;
+	if(numSpectra > 0)
+	{
+		mFilterStride = alignSize(mDFTSize.area() * sizeof(Vec<_Tp, 2>),
+				GABOR_PLAN_FILTER_ALIGNMENT);
+		mSpectra = allocateSpectra(mSpectraStorage, numSpectra,
+				mFilterStride);
+
+		GaborFilteringPlanBody<_Tp> spectraBody(&filterBank, backend,
+				imageSize, mDFTSize.height, mDFTSize.width, mFilterCentre.y,
+				mFilterCentre.x, mResponseOrigin.y, mResponseOrigin.x,
+				mSpectra, mFilterStride, &mSpectrumSlots.front(),
+				&mSeparableKernels.front(), &mRecursiveKernels.front(),
+				&mRealSpectra.front(), &mBackends.front());
+
+		parallel_for(BlockedRange(0, mNumFilters), spectraBody);
+	}
+
+	mReducedSpectra = 0;
+	mReducedFilterStride = 0;
+	// Only complex spectra get a reduced copy
+	if(reducedSpectra && (DataType<_Tp>::depth != CV_32F) &&
+			(numComplexSpectra > 0))
+	{
+		mReducedFilterStride = alignSize(mDFTSize.area() * sizeof(Vec2f),
+				GABOR_PLAN_FILTER_ALIGNMENT);
+		mReducedSpectra = allocateSpectra(mReducedSpectraStorage,
+				numComplexSpectra, mReducedFilterStride);
+
+		for(int i=0; i<mNumFilters; i++)
+		{
+			if(mReducedSlots[i] < 0)
+			{
+				continue;
+			}
+			Mat_<Vec2f> reduced(mDFTSize.height, mDFTSize.width,
+					(Vec2f*)getReducedFilterFFTPtr(i));
+			((Mat)getFilterFFT(i)).convertTo(reduced, CV_32FC2);
+		}
+	}
+}
+
+template<typename _Tp>
+int GaborFilteringPlan<_Tp>::getOptimalDFTSize(int size, int step)
+{
+	CV_Assert(step > 0);
+
+	// The size of the reduced transform is the one made optimal, which keeps
+	// both transforms fast for steps that are themselves optimal sizes
+	return (step * cv::getOptimalDFTSize((size + step - 1) / step));
+}
+
+template<typename _Tp>
+uchar* GaborFilteringPlan<_Tp>::allocateSpectra(Mat& storage,
+		int numFilters, size_t filterStride)
+{
+	// Over-allocate so that the first spectrum starts on a cache line
+	storage.create(1, numFilters*filterStride + GABOR_PLAN_FILTER_ALIGNMENT,
+			CV_8U);
+	return (alignPtr(storage.data, GABOR_PLAN_FILTER_ALIGNMENT));
+}
+
+template<typename _Tp>
+void GaborFilteringPlan<_Tp>::computeGeometry(Size filterSize,
+		Size imageSize, int downSamplingStep, Size minDFTSize, Size& dftSize,
+		Point& filterCentre, Point& responseOrigin)
+{
+	int step = downSamplingStep;
+
+	// Filters of the image size are applied circularly when the image is
+	// already an optimal DFT size
+	Size circularSize(
+			getOptimalDFTSize(max(imageSize.width, minDFTSize.width), step),
+			getOptimalDFTSize(max(imageSize.height, minDFTSize.height),
+			step));
+	if((filterSize == imageSize) && (circularSize == imageSize))
+	{
+		dftSize = imageSize;
+		filterCentre = Point(filterSize.width/2, filterSize.height/2);
+		responseOrigin = Point(0, 0);
+		return;
+	}
+
+	// Otherwise the response centred on a pixel is taken at its position
+	// plus the filter centre, which the frame leaves room for past the
+	// image. The wrapped around part of the kernels then only reaches the
+	// padding. Centres are multiples of the step so that responses reduced
+	// in the frequency domain keep them.
+	filterCentre = Point(
+			(filterSize.width/2 + step - 1) / step * step,
+			(filterSize.height/2 + step - 1) / step * step);
+	dftSize = Size(
+			getOptimalDFTSize(max(filterCentre.x + max(imageSize.width,
+			filterSize.width - filterSize.width/2), minDFTSize.width), step),
+			getOptimalDFTSize(max(filterCentre.y + max(imageSize.height,
+			filterSize.height - filterSize.height/2), minDFTSize.height),
+			step));
+	responseOrigin = filterCentre;
+}
+
+template<typename _Tp>
+Size GaborFilteringPlan<_Tp>::computeDFTSize(
+		const FilterBank<_Tp>& filterBank, Size imageSize,
+		int downSamplingStep, Size minDFTSize)
+{
+	CV_Assert(downSamplingStep > 0);
+
+	Size dftSize;
+	Point filterCentre;
+	Point responseOrigin;
+	computeGeometry(Size(filterBank.getFilterSizeY(),
+			filterBank.getFilterSizeX()), imageSize, downSamplingStep,
+			minDFTSize, dftSize, filterCentre, responseOrigin);
+
+	return (dftSize);
+}
+
+}
+
+#endif /* GABORFILTERINGPLAN_HPP_ */
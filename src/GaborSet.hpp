@@ -28,6 +28,7 @@
 #include "opencv2/opencv.hpp"
 #include "opencv2/core/internal.hpp"
 #include "GaborFilter.hpp"
+#include "FilterBank.hpp"
 #include <vector>
 
 namespace fex {
@@ -51,7 +52,8 @@ public:
 	 * Constructor
 	 */
 	GaborSetBody(int _scales, int _orientations, int _filterSizeX,
-			int _filterSizeY, _Tp _kMax, _Tp _sigma, GaborFilter<_Tp>* _data);
+			int _filterSizeY, _Tp _kMax, _Tp _sigma, int _method,
+			_Tp _supportTolerance, GaborFilter<_Tp>* _data);
 
 	/*
 	 * TBB operator
@@ -74,6 +76,8 @@ private:
 	int mFilterSizeY;
 	_Tp mKMax;
 	_Tp mSigma;
+	int mMethod;
+	_Tp mSupportTolerance;
 };
 
 /******************************************************************************
@@ -88,10 +92,11 @@ private:
 template<typename _Tp>
 GaborSetBody<_Tp>::GaborSetBody(int _scales, int _orientations,
 		int _filterSizeX, int _filterSizeY, _Tp _kMax, _Tp _sigma,
-		GaborFilter<_Tp>* _data) : mScales(_scales),
-		mOrientations(_orientations), mFilterSizeX(_filterSizeX),
-		mFilterSizeY(_filterSizeY), mKMax(_kMax), mSigma(_sigma),
-		data(_data) {}
+		int _method, _Tp _supportTolerance, GaborFilter<_Tp>* _data) :
+		mScales(_scales), mOrientations(_orientations),
+		mFilterSizeX(_filterSizeX), mFilterSizeY(_filterSizeY), mKMax(_kMax),
+		mSigma(_sigma), mMethod(_method),
+		mSupportTolerance(_supportTolerance), data(_data) {}
 
 /**************
  * TBB Operator
@@ -102,14 +107,30 @@ void GaborSetBody<_Tp>::operator() (const BlockedRange& range ) const
 	_Tp scale;
 	_Tp orientation;
 	int numFilters = mScales * mOrientations;
+	int filterSizeX;
+	int filterSizeY;
+	int supportSize;
 
 	for( int index=range.begin(); index!=range.end( ); ++index )
 	{
 		scale = (index/mOrientations);
 		orientation = (index%mOrientations);
 
-		data[index] = GaborFilter<_Tp>(scale, orientation, mFilterSizeX,
-				mFilterSizeY, mKMax, mSigma);
+		filterSizeX = mFilterSizeX;
+		filterSizeY = mFilterSizeY;
+		if(mSupportTolerance > 0)
+		{
+			supportSize = GaborFilter<_Tp>::getSupportSize(scale, mKMax,
+					mSigma, mSupportTolerance);
+			// Odd sizes keep the kernel centre on the nominal one
+			filterSizeX = min(filterSizeX - (1 - filterSizeX%2),
+					supportSize);
+			filterSizeY = min(filterSizeY - (1 - filterSizeY%2),
+					supportSize);
+		}
+
+		data[index] = GaborFilter<_Tp>(scale, orientation, filterSizeX,
+				filterSizeY, mKMax, mSigma, mMethod);
 
 	}
 }
@@ -128,8 +149,16 @@ void GaborSetBody<_Tp>::operator() (const BlockedRange& range ) const
  * compiling, since OpenCV mat's structure does not support them.
  *
  * Using int type is not allowed, and will cause a runtime error.
+ *
+ * A positive supportTolerance sizes every filter from its own scale instead
+ * of the nominal filterSizeX x filterSizeY: each kernel keeps all but that
+ * fraction of the energy of its Gaussian envelope, with odd sizes no larger
+ * than the nominal ones. Fine scales get much smaller kernels this way.
+ * getFilterSizeX/Y still report the nominal frame, and filtering plans place
+ * every kernel centred on it, so results match a fixed-size set up to the
+ * truncated energy.
  */
-template<typename _Tp> class GaborSet
+template<typename _Tp> class GaborSet : public FilterBank<_Tp>
 {
 public:
 	/*
@@ -142,10 +171,12 @@ public:
 	 */
 	GaborSet();
 	GaborSet(int _scales, int _orientations, int _filterSize,
-            _Tp _kMax, _Tp _sigma, bool startAtScaleZero = true);
+            _Tp _kMax, _Tp _sigma, bool startAtScaleZero = true,
+            int _method = GABOR_SPATIAL_DOMAIN, _Tp _supportTolerance = 0);
 	GaborSet(int _scales, int _orientations, int _filterSizeX,
 			int _filterSizeY, _Tp _kMax, _Tp _sigma,
-			bool startAtScaleZero = true);
+			bool startAtScaleZero = true,
+			int _method = GABOR_SPATIAL_DOMAIN, _Tp _supportTolerance = 0);
 	virtual ~GaborSet();
 
 	/*
@@ -158,7 +189,22 @@ public:
 	_Tp getKMax() const;
 	_Tp getSigma() const;
 	bool isStartAtScaleZero() const;
-	GaborFilter<_Tp>* getGaborSet() const;
+	int getMethod() const;
+	_Tp getSupportTolerance() const;
+	const GaborFilter<_Tp>* getGaborSet() const;
+
+	/*
+	 * FilterBank interface
+	 */
+	int getNumFilters() const;
+	Mat_<complex<_Tp> > getKernel(int index) const;
+	void computeKernelFFT(int index, Mat_<Vec<_Tp, 2> >& dst, int dftSizeX,
+			int dftSizeY, int offsetX, int offsetY) const;
+	bool hasRecursiveForm() const;
+	void computeRecursiveKernel(int index, RecursiveGaborKernel& dst,
+			int offsetX, int offsetY) const;
+	double getBandwidth(int index) const;
+	FilterBank<_Tp>* clone() const;
 
 private:
 	/*
@@ -171,18 +217,24 @@ private:
 	_Tp mKMax;
 	_Tp mSigma;
 	bool startAtScaleZero;
-	GaborFilter<_Tp>* mGaborSet;
+	int mMethod;
+	_Tp mSupportTolerance;
+	// Filters are shared by every copy of the set and released with the
+	// last one of them.
+	Ptr<vector<GaborFilter<_Tp> > > mGaborSet;
 
 	/*
 	 * Private functions
 	 */
-	void init(GaborFilter<_Tp>* result, int scales, int orientations,
-			int filterSizeX, int filterSizeY, _Tp kMax, _Tp sigma,
-			bool startAtScaleZero);
+	void init(Ptr<vector<GaborFilter<_Tp> > >& result, int scales,
+			int orientations, int filterSizeX, int filterSizeY, _Tp kMax,
+			_Tp sigma, bool startAtScaleZero, int method,
+			_Tp supportTolerance);
 
-	void generateGaborSet(GaborFilter<_Tp>* result, int scales,
+	void generateGaborSet(Ptr<vector<GaborFilter<_Tp> > >& result, int scales,
 			int orientations, int filterSizeX, int filterSizeY, _Tp kMax,
-			_Tp sigma, bool startAtScaleZero);
+			_Tp sigma, bool startAtScaleZero, int method,
+			_Tp supportTolerance);
 
 };
 
@@ -195,29 +247,30 @@ private:
 /**************
  * Constructors
  **************/
-template<typename _Tp> GaborSet<_Tp>::GaborSet()
+template<typename _Tp> GaborSet<_Tp>::GaborSet() : mScales(0),
+		mOrientations(0), mSupportTolerance(0)
 {
 }
 
 template<typename _Tp> GaborSet<_Tp>::GaborSet(int _scales,
 		int _orientations, int _filterSize, _Tp _kMax, _Tp _sigma,
-		bool startAtScaleZero)
+		bool startAtScaleZero, int _method, _Tp _supportTolerance)
 {
 	init(mGaborSet, _scales, _orientations, _filterSize, _filterSize,
-			_kMax, _sigma, startAtScaleZero);
+			_kMax, _sigma, startAtScaleZero, _method, _supportTolerance);
 }
 
 template<typename _Tp> GaborSet<_Tp>::GaborSet(int _scales,
 		int _orientations, int _filterSizeX, int _filterSizeY, _Tp _kMax,
-		_Tp _sigma, bool startAtScaleZero)
+		_Tp _sigma, bool startAtScaleZero, int _method,
+		_Tp _supportTolerance)
 {
 	init(mGaborSet, _scales, _orientations, _filterSizeX, _filterSizeY,
-			_kMax, _sigma, startAtScaleZero);
+			_kMax, _sigma, startAtScaleZero, _method, _supportTolerance);
 }
 
 template<typename _Tp> GaborSet<_Tp>::~GaborSet()
 {
-	//delete [] mGaborSet;
 }
 
 /*******************
@@ -260,19 +313,95 @@ inline _Tp GaborSet<_Tp>::getSigma() const
 }
 
 template<typename _Tp>
-inline GaborFilter<_Tp>*
+inline bool GaborSet<_Tp>::isStartAtScaleZero() const
+{
+    return (startAtScaleZero);
+}
+
+template<typename _Tp>
+inline int GaborSet<_Tp>::getMethod() const
+{
+    return (mMethod);
+}
+
+template<typename _Tp>
+inline _Tp GaborSet<_Tp>::getSupportTolerance() const
+{
+    return (mSupportTolerance);
+}
+
+template<typename _Tp>
+inline const GaborFilter<_Tp>*
 GaborSet<_Tp>::getGaborSet() const
 {
-	return (mGaborSet);
+	if(mGaborSet.empty())
+	{
+		return (0);
+	}
+	return (&mGaborSet->front());
+}
+
+/*********************
+ * FilterBank interface
+ *********************/
+template<typename _Tp>
+inline int GaborSet<_Tp>::getNumFilters() const
+{
+	return (mScales * mOrientations);
+}
+
+template<typename _Tp>
+inline Mat_<complex<_Tp> > GaborSet<_Tp>::getKernel(int index) const
+{
+	return ((*mGaborSet)[index].getFilter());
+}
+
+template<typename _Tp>
+void GaborSet<_Tp>::computeKernelFFT(int index, Mat_<Vec<_Tp, 2> >& dst,
+		int dftSizeX, int dftSizeY, int offsetX, int offsetY) const
+{
+	(*mGaborSet)[index].computeFilterFFT(dst, dftSizeX, dftSizeY, offsetX,
+			offsetY);
+}
+
+template<typename _Tp>
+bool GaborSet<_Tp>::hasRecursiveForm() const
+{
+	return (true);
+}
+
+template<typename _Tp>
+void GaborSet<_Tp>::computeRecursiveKernel(int index,
+		RecursiveGaborKernel& dst, int offsetX, int offsetY) const
+{
+	(*mGaborSet)[index].computeRecursiveKernel(dst, offsetX, offsetY);
+}
+
+template<typename _Tp>
+double GaborSet<_Tp>::getBandwidth(int index) const
+{
+	// The spectrum of a filter is a Gaussian of standard deviation k/sigma
+	// around the frequency k of its scale, and the envelope keeps three
+	// standard deviations of it
+	double k = mKMax/pow(sqrt(2.0), index/mOrientations);
+	return (3*k/mSigma);
+}
+
+template<typename _Tp>
+FilterBank<_Tp>* GaborSet<_Tp>::clone() const
+{
+	// Copies share the filters
+	return (new GaborSet<_Tp>(*this));
 }
 
 /*******************
  * Private functions
  *******************/
 template<typename _Tp>
-void GaborSet<_Tp>::init(GaborFilter<_Tp>* result, int scales,
-		int orientations, int filterSizeX, int filterSizeY, _Tp kMax,
-		_Tp sigma, bool startAtScaleZero)
+void GaborSet<_Tp>::init(Ptr<vector<GaborFilter<_Tp> > >& result,
+		int scales, int orientations, int filterSizeX, int filterSizeY,
+		_Tp kMax, _Tp sigma, bool startAtScaleZero, int method,
+		_Tp supportTolerance)
 {
 
 	mScales = scales;
@@ -281,15 +410,20 @@ void GaborSet<_Tp>::init(GaborFilter<_Tp>* result, int scales,
 	mFilterSizeY = filterSizeY;
 	mKMax = kMax;
 	mSigma = sigma;
+	this->startAtScaleZero = startAtScaleZero;
+	mMethod = method;
+	mSupportTolerance = supportTolerance;
 	generateGaborSet(mGaborSet, scales, orientations, filterSizeX,
-			filterSizeY, kMax, sigma, startAtScaleZero);
+			filterSizeY, kMax, sigma, startAtScaleZero, method,
+			supportTolerance);
 
 }
 
 template<typename _Tp>
-void GaborSet<_Tp>::generateGaborSet(GaborFilter<_Tp>* result,
-		int scales, int orientations, int filterSizeX, int filterSizeY,
-		_Tp kMax, _Tp sigma, bool startAtScaleZero)
+void GaborSet<_Tp>::generateGaborSet(
+		Ptr<vector<GaborFilter<_Tp> > >& result, int scales,
+		int orientations, int filterSizeX, int filterSizeY, _Tp kMax,
+		_Tp sigma, bool startAtScaleZero, int method, _Tp supportTolerance)
 {
 
 	int startScale = 0;
@@ -302,10 +436,11 @@ void GaborSet<_Tp>::generateGaborSet(GaborFilter<_Tp>* result,
 		stopScale = scales;
 	}
 
-	mGaborSet = new GaborFilter<_Tp>[mScales*mOrientations];
+	result = new vector<GaborFilter<_Tp> >(mScales*mOrientations);
 
 	GaborSetBody<_Tp> gaborSetBody(mScales, mOrientations, mFilterSizeX,
-			mFilterSizeY, mKMax, mSigma, mGaborSet);
+			mFilterSizeY, mKMax, mSigma, mMethod, mSupportTolerance,
+			&result->front());
 
 	parallel_for(BlockedRange(0, mScales*mOrientations), gaborSetBody);
 }
@@ -0,0 +1,66 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *  
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *   
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *   
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#include "GaborSetCache.hpp"
+
+namespace fex
+{
+using namespace cv;
+
+bool GaborSetCache::Key::operator<(const Key& other) const
+{
+    if(depth != other.depth) return (depth < other.depth);
+    if(scales != other.scales) return (scales < other.scales);
+    if(orientations != other.orientations)
+        return (orientations < other.orientations);
+    if(filterSizeX != other.filterSizeX)
+        return (filterSizeX < other.filterSizeX);
+    if(filterSizeY != other.filterSizeY)
+        return (filterSizeY < other.filterSizeY);
+    if(kMax != other.kMax) return (kMax < other.kMax);
+    if(sigma != other.sigma) return (sigma < other.sigma);
+    if(startAtScaleZero != other.startAtScaleZero)
+        return (startAtScaleZero < other.startAtScaleZero);
+    if(method != other.method) return (method < other.method);
+    return (supportTolerance < other.supportTolerance);
+}
+
+void GaborSetCache::clear()
+{
+    AutoLock lock(getMutex());
+    getSets<float>().clear();
+    getSets<double>().clear();
+}
+
+size_t GaborSetCache::size()
+{
+    AutoLock lock(getMutex());
+    return (getSets<float>().size() + getSets<double>().size());
+}
+
+Mutex& GaborSetCache::getMutex()
+{
+    static Mutex mutex;
+    return (mutex);
+}
+
+}
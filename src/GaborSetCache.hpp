@@ -0,0 +1,154 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef GABORSETCACHE_HPP_
+#define GABORSETCACHE_HPP_
+
+// TODO: Check really needed header files, including all OpenCV headers
+// is way too much
+#include "opencv2/opencv.hpp"
+#include "GaborSet.hpp"
+#include <map>
+
+namespace fex
+{
+
+using namespace cv;
+
+/*
+ * Process-wide registry of Gabor filter sets.
+ *
+ * Sets are keyed by (scales, orientations, filterSizeX, filterSizeY, kMax,
+ * sigma, startAtScaleZero, method, supportTolerance, element type) and are
+ * generated only the first time they are requested. The returned GaborSet
+ * objects share the cached filters by reference counting, so they are cheap
+ * to copy and can be read from several threads at once.
+ */
+class GaborSetCache
+{
+public:
+
+    template<typename _Tp>
+    static GaborSet<_Tp> get(int scales, int orientations, int filterSize,
+            _Tp kMax, _Tp sigma, bool startAtScaleZero = true,
+            int method = GABOR_SPATIAL_DOMAIN, _Tp supportTolerance = 0);
+
+    template<typename _Tp>
+    static GaborSet<_Tp> get(int scales, int orientations, int filterSizeX,
+            int filterSizeY, _Tp kMax, _Tp sigma,
+            bool startAtScaleZero = true,
+            int method = GABOR_SPATIAL_DOMAIN, _Tp supportTolerance = 0);
+
+    /*
+     * Drops every cached set. Sets already handed out stay valid until their
+     * last copy is destroyed.
+     */
+    static void clear();
+
+    static size_t size();
+
+private:
+
+    /*
+     * Cache key
+     */
+    struct Key
+    {
+        int depth;
+        int scales;
+        int orientations;
+        int filterSizeX;
+        int filterSizeY;
+        double kMax;
+        double sigma;
+        bool startAtScaleZero;
+        int method;
+        double supportTolerance;
+
+        bool operator<(const Key& other) const;
+    };
+
+    template<typename _Tp>
+    static map<Key, GaborSet<_Tp> >& getSets();
+
+    static Mutex& getMutex();
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+template<typename _Tp>
+GaborSet<_Tp> GaborSetCache::get(int scales, int orientations,
+        int filterSize, _Tp kMax, _Tp sigma, bool startAtScaleZero,
+        int method, _Tp supportTolerance)
+{
+    return (get<_Tp>(scales, orientations, filterSize, filterSize, kMax,
+            sigma, startAtScaleZero, method, supportTolerance));
+}
+
+template<typename _Tp>
+GaborSet<_Tp> GaborSetCache::get(int scales, int orientations,
+        int filterSizeX, int filterSizeY, _Tp kMax, _Tp sigma,
+        bool startAtScaleZero, int method, _Tp supportTolerance)
+{
+    Key key;
+    key.depth = DataType<_Tp>::depth;
+    key.scales = scales;
+    key.orientations = orientations;
+    key.filterSizeX = filterSizeX;
+    key.filterSizeY = filterSizeY;
+    key.kMax = kMax;
+    key.sigma = sigma;
+    key.startAtScaleZero = startAtScaleZero;
+    key.method = method;
+    key.supportTolerance = supportTolerance;
+
+    // Sets are generated while holding the lock, so concurrent requests for
+    // the same parameters never build the same set twice.
+    AutoLock lock(getMutex());
+
+    map<Key, GaborSet<_Tp> >& sets = getSets<_Tp>();
+    typename map<Key, GaborSet<_Tp> >::iterator it = sets.find(key);
+
+    if(it == sets.end())
+    {
+        it = sets.insert(make_pair(key, GaborSet<_Tp>(scales, orientations,
+                filterSizeX, filterSizeY, kMax, sigma, startAtScaleZero,
+                method, supportTolerance))).first;
+    }
+
+    return (it->second);
+}
+
+template<typename _Tp>
+map<GaborSetCache::Key, GaborSet<_Tp> >& GaborSetCache::getSets()
+{
+    static map<Key, GaborSet<_Tp> > sets;
+    return (sets);
+}
+
+}
+
+#endif /* GABORSETCACHE_HPP_ */
@@ -26,17 +26,285 @@
 // TODO: Check really needed header files, including all OpenCV headers
 // is way too much
 #include "opencv2/opencv.hpp"
+#include "opencv2/core/internal.hpp"
 #include "MathHelpers.hpp"
+#include "FFTBackend.hpp"
+#include <vector>
+#include <complex>
+#if defined(__SSE3__) || defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 namespace fex
 {
 
 using namespace cv;
 
+// Bytes of an image spectrum multiplied by every filter of a bank before
+// moving to the next ones, about half of a level 1 data cache
+const int SPECTRUM_BLOCK_SIZE = 16384;
+
+/*
+ * Ways of combining the responses of the channels of an image.
+ *
+ * CHANNELS_CONCATENATE keeps the features of every channel, one after the
+ * other. CHANNELS_SUM and CHANNELS_MAX keep the sum or the maximum of the
+ * magnitudes of the channels at each pixel, giving as many features as a
+ * single channel image.
+ */
+enum
+{
+    CHANNELS_CONCATENATE = 0,
+    CHANNELS_SUM = 1,
+    CHANNELS_MAX = 2
+};
+
+/*
+ * Magnitudes computed from the complex responses.
+ *
+ * MAGNITUDE_EXACT is sqrt(re^2 + im^2). MAGNITUDE_SQUARED is re^2 + im^2,
+ * without the square root. MAGNITUDE_APPROXIMATE is the alpha max plus beta
+ * min approximation, MAGNITUDE_ALPHA*max(|re|, |im|) +
+ * MAGNITUDE_BETA*min(|re|, |im|), whose relative error is below 3.96%.
+ */
+enum
+{
+    MAGNITUDE_EXACT = 0,
+    MAGNITUDE_SQUARED = 1,
+    MAGNITUDE_APPROXIMATE = 2
+};
+
+// Coefficients of MAGNITUDE_APPROXIMATE minimizing its largest relative
+// error, reached at both ends of [0, pi/4]
+const double MAGNITUDE_ALPHA = 0.96043387;
+const double MAGNITUDE_BETA = 0.39782473;
+
+/*
+ * Pooling of magnitudes over non-overlapping square blocks
+ */
+enum
+{
+    POOLING_NONE = 0,
+    POOLING_AVERAGE = 1,
+    POOLING_MAX = 2
+};
+
+/*
+ * Low-rank separable form of a complex kernel: a sum of outer products of a
+ * column (vertical) and a row (horizontal) 1D kernel, for its real and its
+ * imaginary parts. Terms are stored flipped, ready for correlation.
+ *
+ * (offsetX, offsetY) is where the kernel top-left corner is placed, in the
+ * same way ImageHelpers::complexDFT places a kernel at the top-left corner of
+ * its padded frame. Negative offsets, down to one less than the kernel
+ * size, place it before the image, as centred responses need.
+ */
+template<typename _Tp> struct SeparableKernel
+{
+    int sizeX;
+    int sizeY;
+    int offsetX;
+    int offsetY;
+    vector<Mat_<_Tp> > realColumns;
+    vector<Mat_<_Tp> > realRows;
+    vector<Mat_<_Tp> > imagColumns;
+    vector<Mat_<_Tp> > imagRows;
+
+    int getNumTerms() const
+    {
+        return (realColumns.size() + imagColumns.size());
+    }
+};
+
+/*
+ * Gabor kernel in the form used by recursive (IIR) filtering: a Gaussian
+ * envelope of standard deviation sigma pixels times the carrier
+ * exp(i*(omegaX*x + omegaY*y)) minus dcTerm, scaled by gain, with x along
+ * rows and y along columns. Its centre is placed at (offsetX, offsetY), as
+ * the FFT path places it relative to the responses it keeps.
+ *
+ * coefficients hold B, b1/b0, b2/b0 and b3/b0 of the Young/van Vliet
+ * recursive Gaussian for sigma.
+ */
+struct RecursiveGaborKernel
+{
+    double sigma;
+    double omegaX;
+    double omegaY;
+    double dcTerm;
+    double gain;
+    int offsetX;
+    int offsetY;
+    double coefficients[4];
+};
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                          RecursiveGaussianBody                           ==
+ ==============================================================================
+ ==============================================================================
+ */
+
+/*
+ * Template class for the parallel passes of a recursive Gaussian, in place
+ * and with zero boundary conditions, over every channel of an image.
+ *
+ * Horizontal passes split the image by rows. Vertical passes update whole
+ * rows at a time, so they split each row into ranges of elements and walk
+ * the image top to bottom and back.
+ */
+template<typename _Tp> class RecursiveGaussianBody
+{
+public:
+
+	/*
+	 * Constructor
+	 */
+	RecursiveGaussianBody(Mat _data, const double* _coefficients,
+			bool _vertical);
+
+	/*
+	 * TBB operator
+	 */
+	void operator() (const BlockedRange& range ) const;
+
+private:
+
+	/*
+	 * Input and output arguments
+	 */
+	_Tp* data;
+
+	/*
+	 * Arguments needed for computation
+	 */
+	int mRows;
+	int mChannels;
+	int mWidth;
+	size_t mStep;
+	double mB;
+	double mA1;
+	double mA2;
+	double mA3;
+	bool mVertical;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/*************
+ * Constructor
+ *************/
+template<typename _Tp>
+RecursiveGaussianBody<_Tp>::RecursiveGaussianBody(Mat _data,
+		const double* _coefficients, bool _vertical) :
+		data((_Tp*)_data.data), mRows(_data.rows),
+		mChannels(_data.channels()), mWidth(_data.cols * _data.channels()),
+		mStep(_data.step / sizeof(_Tp)), mB(_coefficients[0]),
+		mA1(_coefficients[1]), mA2(_coefficients[2]), mA3(_coefficients[3]),
+		mVertical(_vertical) {}
+
+/**************
+ * TBB Operator
+ **************/
+template<typename _Tp>
+void RecursiveGaussianBody<_Tp>::operator() (
+		const BlockedRange& range ) const
+{
+	int rows = mRows;
+	int channels = mChannels;
+	int width = mWidth;
+	double w;
+	double w1;
+	double w2;
+	double w3;
+
+	if(mVertical)
+	{
+		// Rows before the first and after the last one are zero
+		vector<_Tp> zeros(width, 0);
+		const _Tp* previous[3];
+
+		for(int i=0; i<rows; i++)
+		{
+			_Tp* row = data + i*mStep;
+			for(int k=0; k<3; k++)
+			{
+				previous[k] = (i > k) ? data + (i-k-1)*mStep :
+						&zeros.front();
+			}
+			for(int j=range.begin(); j!=range.end(); ++j)
+			{
+				row[j] = mB*row[j] + mA1*previous[0][j] +
+						mA2*previous[1][j] + mA3*previous[2][j];
+			}
+		}
+
+		for(int i=rows-1; i>=0; i--)
+		{
+			_Tp* row = data + i*mStep;
+			for(int k=0; k<3; k++)
+			{
+				previous[k] = (i+k+1 < rows) ? data + (i+k+1)*mStep :
+						&zeros.front();
+			}
+			for(int j=range.begin(); j!=range.end(); ++j)
+			{
+				row[j] = mB*row[j] + mA1*previous[0][j] +
+						mA2*previous[1][j] + mA3*previous[2][j];
+			}
+		}
+		return;
+	}
+
+	for(int i=range.begin(); i!=range.end(); ++i)
+	{
+		_Tp* row = data + i*mStep;
+		for(int c=0; c<channels; c++)
+		{
+			w1 = w2 = w3 = 0;
+			for(int j=c; j<width; j+=channels)
+			{
+				w = mB*row[j] + mA1*w1 + mA2*w2 + mA3*w3;
+				row[j] = w;
+				w3 = w2;
+				w2 = w1;
+				w1 = w;
+			}
+
+			w1 = w2 = w3 = 0;
+			for(int j=width-channels+c; j>=0; j-=channels)
+			{
+				w = mB*row[j] + mA1*w1 + mA2*w2 + mA3*w3;
+				row[j] = w;
+				w3 = w2;
+				w2 = w1;
+				w1 = w;
+			}
+		}
+	}
+}
+
+/*
+ ==============================================================================
+ ==============================================================================
+ ==                              ImageHelpers                                ==
+ ==============================================================================
+ ==============================================================================
+ */
+
 class ImageHelpers
 {
 public:
 
+    /*
+     * Forward and inverse transforms below run on FFTBackend::getDefault(),
+     * unless they are given a backend.
+     */
     template<typename _Tp>
     static void complexDFT(Mat_<_Tp> image, Mat_<Vec<_Tp, 2> >& dst);
 
@@ -44,9 +312,86 @@ public:
     static void complexDFT(Mat_<complex<_Tp> > image,
     		Mat_<Vec<_Tp, 2> >& dst);
 
+    /*
+     * Same as above, zero-padding the image at the bottom and right up to
+     * dftSize instead of up to its own optimal DFT size. Real images are
+     * transformed with a real-input DFT, whose Hermitian half spectrum is
+     * expanded to the full complex one.
+     */
+    template<typename _Tp>
+    static void complexDFT(Mat_<_Tp> image, Mat_<Vec<_Tp, 2> >& dst,
+            Size dftSize);
+
+    template<typename _Tp>
+    static void complexDFT(Mat_<complex<_Tp> > image,
+            Mat_<Vec<_Tp, 2> >& dst, Size dftSize);
+
+    /*
+     * Half spectrum of a real image zero-padded up to dftSize, in the packed
+     * CCS format of cv::dft. Enough to filter it with real kernels.
+     */
+    template<typename _Tp>
+    static void realDFT(Mat_<_Tp> image, Mat_<_Tp>& dst, Size dftSize);
+
+    /*
+     * Batched versions of the two above for count images of the same size,
+     * transformed at once. Their spectra are stacked one below the other in
+     * dst, dftSize.height rows each.
+     *
+     * The images may have any depth, 8 or 16 bit ones being converted to
+     * _Tp as they are copied into the padded input of the transform. Each
+     * channel of a multi-channel image is transformed on its own, the
+     * spectra of an image being stacked channel after channel.
+     */
+    template<typename _Tp, typename _Ip>
+    static void complexDFT(const Mat_<_Ip>* images, int count,
+            Mat_<Vec<_Tp, 2> >& dst, Size dftSize);
+
+    template<typename _Tp, typename _Ip>
+    static void realDFT(const Mat_<_Ip>* images, int count, Mat_<_Tp>& dst,
+            Size dftSize);
+
+    /*
+     * Same as above, padding the images in the given buffer, which is only
+     * reallocated if it does not have the padded size already, and
+     * transforming them on the given backend.
+     */
+    template<typename _Tp, typename _Ip>
+    static void complexDFT(const Mat_<_Ip>* images, int count,
+            Mat_<Vec<_Tp, 2> >& dst, Size dftSize, Mat_<_Tp>& padded,
+            FFTBackend& fft);
+
+    template<typename _Tp, typename _Ip>
+    static void realDFT(const Mat_<_Ip>* images, int count, Mat_<_Tp>& dst,
+            Size dftSize, Mat_<_Tp>& padded, FFTBackend& fft);
+
+    /*
+     * One channel of an image converted to _Tp into dst, which must already
+     * have the size of the image.
+     */
+    template<typename _Tp, typename _Ip>
+    static void convertChannel(Mat_<_Ip> image, int channel, Mat_<_Tp> dst);
+
+    /*
+     * Magnitude of each pixel of a complex image, computed on the
+     * interleaved data as mode says (see MAGNITUDE_EXACT).
+     */
     template<typename _Tp>
     static void magnitudeComplexImage(Mat_<Vec<_Tp, 2> > image,
-    		Mat_<_Tp>& dst);
+    		Mat_<_Tp>& dst, int mode = MAGNITUDE_EXACT);
+
+    /*
+     * Magnitude of a single complex value
+     */
+    template<typename _Tp>
+    static _Tp complexMagnitude(_Tp real, _Tp imag, int mode);
+
+    /*
+     * A magnitude written to dst, or combined with it as CHANNELS_SUM and
+     * CHANNELS_MAX say
+     */
+    template<typename _Tp>
+    static void combineMagnitude(_Tp& dst, _Tp magnitude, int combination);
 
     template<typename _Tp>
     static void convolutionComplexFilter(Mat_<_Tp> image,
@@ -57,6 +402,139 @@ public:
             Mat_<Vec<_Tp, 2> > complexDFTImage,
             Mat_<Vec<_Tp, 2> > complexDFTFilter, Mat_<Vec<_Tp, 2> >& dst);
 
+    /*
+     * Same as above for a filter spectrum stored row after row, with the
+     * size of the image spectrum, possibly in a lower precision than the
+     * image.
+     */
+    template<typename _Tp, typename _Sp>
+    static void convolutionComplexFilter(
+            Mat_<Vec<_Tp, 2> > complexDFTImage,
+            const Vec<_Sp, 2>* complexDFTFilter, Mat_<Vec<_Tp, 2> >& dst);
+
+    /*
+     * Product of an image spectrum and a filter spectrum stored as above,
+     * written to dst, which must already have the size of the image one.
+     */
+    template<typename _Tp, typename _Sp>
+    static void multiplyComplexSpectra(Mat_<Vec<_Tp, 2> > complexDFTImage,
+            const Vec<_Sp, 2>* complexDFTFilter, Mat_<Vec<_Tp, 2> > dst);
+
+    /*
+     * Products of an image spectrum with count filter spectra stored as
+     * above, stacked one below the other in dst, which must already have
+     * count times the rows of the image spectrum. The image spectrum is
+     * walked in blocks of SPECTRUM_BLOCK_SIZE bytes, and each block is
+     * multiplied by the matching block of every filter while it is in
+     * cache, so the image spectrum is read from memory once.
+     */
+    template<typename _Tp, typename _Sp>
+    static void multiplyComplexSpectra(Mat_<Vec<_Tp, 2> > complexDFTImage,
+            const Vec<_Sp, 2>* const* complexDFTFilters, int count,
+            Mat_<Vec<_Tp, 2> > dst);
+
+    /*
+     * Product of n interleaved (real, imaginary) pairs, which may be done in
+     * place. Single and double precision products use AVX-512, AVX (with
+     * FMA if available) or SSE3 when the compiler targets them.
+     */
+    template<typename _Tp, typename _Sp>
+    static void multiplyComplexRow(const _Tp* image, const _Sp* filter,
+            _Tp* product, int n);
+
+    /*
+     * Spectrum of a response downsampled by step along each axis, for an
+     * inverse DFT at the reduced size. The spectrum size must be a multiple
+     * of step, and dst must already have the reduced size.
+     *
+     * foldSpectrum() sums the aliased bins, so the inverse gives exactly
+     * every step-th sample of the full inverse, as downSample() with
+     * INTER_NEAREST does. cropSpectrum() keeps the band around DC instead,
+     * an ideal low-pass filter before sampling.
+     */
+    template<typename _Tp>
+    static void foldSpectrum(Mat_<Vec<_Tp, 2> > spectrum,
+            Mat_<Vec<_Tp, 2> > dst, int step);
+
+    template<typename _Tp>
+    static void cropSpectrum(Mat_<Vec<_Tp, 2> > spectrum,
+            Mat_<Vec<_Tp, 2> > dst, int step);
+
+    /*
+     * Convolution with a real filter, both given by their CCS packed half
+     * spectra (the filter one stored row after row). Only the half spectrum
+     * product and a real-output inverse DFT are needed. The response is
+     * returned as complex, with a zero imaginary part.
+     */
+    template<typename _Tp>
+    static void convolutionRealFilter(Mat_<_Tp> realDFTImage,
+            const _Tp* realDFTFilter, Mat_<Vec<_Tp, 2> >& dst);
+
+    /*
+     * Decomposes a kernel into separable terms through the SVD of its real
+     * and imaginary parts, dropping terms while the relative Frobenius error
+     * stays below tolerance. Axis-aligned Gabor kernels need a single term
+     * per part, any other orientation at most two (plus one for the DC
+     * compensation, when it is not negligible).
+     */
+    template<typename _Tp>
+    static void separableDecomposition(Mat_<complex<_Tp> > kernel,
+            SeparableKernel<_Tp>& dst, double tolerance = 1e-6,
+            int offsetX = 0, int offsetY = 0);
+
+    /*
+     * Direct spatial convolution of a real image with a separable kernel.
+     * The result has the size of the image and matches the FFT convolution
+     * of ImageHelpers::convolutionComplexFilter wherever the latter does not
+     * wrap around the image borders.
+     *
+     * dst and term, the scratch buffer of each term, are written in place
+     * when they already have the size of the image.
+     */
+    template<typename _Tp>
+    static void convolutionSeparable(Mat_<_Tp> image,
+            const SeparableKernel<_Tp>& kernel, Mat_<Vec<_Tp, 2> >& dst,
+            Mat_<_Tp> term = Mat_<_Tp>());
+
+    /*
+     * Young/van Vliet coefficients of the recursive Gaussian of standard
+     * deviation sigma, which must be at least half a pixel.
+     */
+    static void recursiveGaussianCoefficients(double sigma,
+            double* coefficients);
+
+    /*
+     * In place recursive Gaussian, with a cost per pixel independent of its
+     * standard deviation.
+     */
+    template<typename _Tp>
+    static void recursiveGaussian(Mat image, const double* coefficients);
+
+    /*
+     * Recursive Gabor filtering: the image is demodulated by the carrier,
+     * smoothed by recursive Gaussians and modulated back. The result has the
+     * size of the image and approximates the output of
+     * ImageHelpers::convolutionSeparable for a kernel placed at the same
+     * offset, up to the truncation of the spatial kernel and the error of the
+     * recursive approximation (a few percent of the response energy on white
+     * noise, less on natural images).
+     *
+     * dst, and the padded and demodulated scratch images, are written in
+     * place when they already have their size: the size of the image for
+     * dst, getRecursivePaddedSize() for the other two.
+     */
+    template<typename _Tp>
+    static void convolutionRecursiveGabor(Mat_<_Tp> image,
+            const RecursiveGaborKernel& kernel, Mat_<Vec<_Tp, 2> >& dst,
+            Mat_<_Tp> padded = Mat_<_Tp>(),
+            Mat_<Vec<_Tp, 2> > demodulated = Mat_<Vec<_Tp, 2> >());
+
+    /*
+     * Size an image is padded to by convolutionRecursiveGabor
+     */
+    static Size getRecursivePaddedSize(Size imageSize,
+            const RecursiveGaborKernel& kernel);
+
     template<typename _Tp>
 	static void downSample(Mat_<Vec<_Tp, 2> > image,
 			Mat_<Vec<_Tp, 2> >& dst, double ratio, int method=INTER_NEAREST);
@@ -64,49 +542,280 @@ public:
     template<typename _Tp>
     static void zmuNormalization(Mat_<Vec<_Tp, 2> > image,
     		Mat_<Vec<_Tp, 2> >& dst);
+
+    /*
+     * Magnitude of a complex response, written row after row to dst, one
+     * value per pixel. With needZMUNorm the response is normalized first as
+     * zmuNormalization() does, from statistics gathered in a single pass over
+     * the interleaved response: it is read twice, and no planes are built.
+     *
+     * With CHANNELS_SUM or CHANNELS_MAX the magnitudes are added to, or
+     * kept when larger than, the values already in dst. They are computed
+     * as mode says (see MAGNITUDE_EXACT).
+     *
+     * With pooling, the magnitudes of each block of poolingStep x
+     * poolingStep pixels are averaged or maxed into one value, for
+     * cvRound(rows/poolingStep) x cvRound(cols/poolingStep) values, the size
+     * downSample() gives for the same ratio. When a side is not a multiple
+     * of poolingStep and rounds up, its last blocks are smaller; when it
+     * rounds down, its trailing pixels are left out of every block.
+     */
+    template<typename _Tp>
+    static void zmuMagnitude(Mat_<Vec<_Tp, 2> > image, _Tp* dst,
+            bool needZMUNorm, int combination = CHANNELS_CONCATENATE,
+            int mode = MAGNITUDE_EXACT, int pooling = POOLING_NONE,
+            int poolingStep = 1);
+
+    /*
+     * Same as above with the normalization statistics given: the mean of
+     * the real and imaginary parts and their joint standard deviation.
+     */
+    template<typename _Tp>
+    static void zmuMagnitude(Mat_<Vec<_Tp, 2> > image, _Tp* dst,
+            Vec<_Tp, 2> mean, _Tp std,
+            int combination = CHANNELS_CONCATENATE,
+            int mode = MAGNITUDE_EXACT, int pooling = POOLING_NONE,
+            int poolingStep = 1);
+
+    /*
+     * Number of values along a side of n pixels pooled by blocks of step,
+     * rounded as downSample() rounds it
+     */
+    static int getPooledSize(int n, int step);
+
+    /*
+     * Statistics used by zmuNormalization(), taken from the unscaled DFT of
+     * the response instead: the mean from its DC term and the variance from
+     * Parseval's theorem. Only valid when the response is the whole inverse
+     * transform, with no padding cropped or spatial downsampling applied.
+     */
+    template<typename _Tp>
+    static void spectrumStdMean(Mat_<Vec<_Tp, 2> > spectrum,
+            Vec<_Tp, 2>& mean, _Tp& std);
 };
 
 template<typename _Tp>
 void ImageHelpers::complexDFT(Mat_<_Tp> image, Mat_<Vec<_Tp, 2> >& dst)
 {
-    int M = getOptimalDFTSize(image.rows);
-    int N = getOptimalDFTSize(image.cols);
+    complexDFT(image, dst, Size(getOptimalDFTSize(image.cols),
+            getOptimalDFTSize(image.rows)));
+}
 
+template<typename _Tp>
+void ImageHelpers::complexDFT(Mat_<complex<_Tp> > image,
+		Mat_<Vec<_Tp, 2> >& dst)
+{
+    complexDFT(image, dst, Size(getOptimalDFTSize(image.cols),
+            getOptimalDFTSize(image.rows)));
+}
+
+template<typename _Tp>
+void ImageHelpers::complexDFT(Mat_<_Tp> image, Mat_<Vec<_Tp, 2> >& dst,
+        Size dftSize)
+{
+    int M = dftSize.height;
+    int N = dftSize.width;
+
+    CV_Assert((image.rows <= M) && (image.cols <= N));
+
+    Mat_<_Tp> padded = image;
+    if((image.rows != M) || (image.cols != N))
+    {
+        copyMakeBorder(image, padded, 0, M - image.rows, 0, N - image.cols,
+                BORDER_CONSTANT, Scalar::all(0));
+    }
+
+    // Real input, only the rows holding the image are non zero
+    FFTBackend::getDefault()->dft(padded, dst, DFT_COMPLEX_OUTPUT,
+            image.rows);
+}
+
+template<typename _Tp>
+void ImageHelpers::realDFT(Mat_<_Tp> image, Mat_<_Tp>& dst, Size dftSize)
+{
+    int M = dftSize.height;
+    int N = dftSize.width;
+
+    CV_Assert((image.rows <= M) && (image.cols <= N));
+
+    Mat_<_Tp> padded = image;
+    if((image.rows != M) || (image.cols != N))
+    {
+        copyMakeBorder(image, padded, 0, M - image.rows, 0, N - image.cols,
+                BORDER_CONSTANT, Scalar::all(0));
+    }
+
+    FFTBackend::getDefault()->dft(padded, dst, 0, image.rows);
+}
+
+template<typename _Tp, typename _Ip>
+void ImageHelpers::complexDFT(const Mat_<_Ip>* images, int count,
+        Mat_<Vec<_Tp, 2> >& dst, Size dftSize)
+{
     Mat_<_Tp> padded;
-    copyMakeBorder(image, padded, 0, M - image.rows, 0, N - image.cols,
-            BORDER_CONSTANT, Scalar::all(0));
+    complexDFT(images, count, dst, dftSize, padded,
+            *FFTBackend::getDefault());
+}
+
+template<typename _Tp, typename _Ip>
+void ImageHelpers::complexDFT(const Mat_<_Ip>* images, int count,
+        Mat_<Vec<_Tp, 2> >& dst, Size dftSize, Mat_<_Tp>& padded,
+        FFTBackend& fft)
+{
+    int M = dftSize.height;
+    int N = dftSize.width;
+
+    int cn = DataType<_Ip>::channels;
+
+    // All channels zero-padded in one buffer, transformed with one call
+    padded.create(count*cn*M, N);
+    ((Mat)padded).setTo(Scalar::all(0));
+    for(int k=0; k<count; k++)
+    {
+        CV_Assert((images[k].rows <= M) && (images[k].cols <= N));
+
+        for(int c=0; c<cn; c++)
+        {
+            // Converted to the transform precision on the way
+            convertChannel(images[k], c, padded(Rect(0, (k*cn + c)*M,
+                    images[k].cols, images[k].rows)));
+        }
+    }
 
-    Mat_<_Tp> planes[] = {padded, Mat::zeros(padded.size(), padded.type())};
-    Mat_<Vec<_Tp, 2> > complexImg(M,N);
+    fft.dftBatch(padded, dst, count*cn, DFT_COMPLEX_OUTPUT);
+}
 
-    merge(planes, 2, complexImg);
-    dft(complexImg, dst, DFT_COMPLEX_OUTPUT);
+template<typename _Tp, typename _Ip>
+void ImageHelpers::realDFT(const Mat_<_Ip>* images, int count,
+        Mat_<_Tp>& dst, Size dftSize)
+{
+    Mat_<_Tp> padded;
+    realDFT(images, count, dst, dftSize, padded, *FFTBackend::getDefault());
+}
+
+template<typename _Tp, typename _Ip>
+void ImageHelpers::realDFT(const Mat_<_Ip>* images, int count,
+        Mat_<_Tp>& dst, Size dftSize, Mat_<_Tp>& padded, FFTBackend& fft)
+{
+    int M = dftSize.height;
+    int N = dftSize.width;
+
+    int cn = DataType<_Ip>::channels;
+
+    padded.create(count*cn*M, N);
+    ((Mat)padded).setTo(Scalar::all(0));
+    for(int k=0; k<count; k++)
+    {
+        CV_Assert((images[k].rows <= M) && (images[k].cols <= N));
+
+        for(int c=0; c<cn; c++)
+        {
+            convertChannel(images[k], c, padded(Rect(0, (k*cn + c)*M,
+                    images[k].cols, images[k].rows)));
+        }
+    }
+
+    fft.dftBatch(padded, dst, count*cn, 0);
 }
 
 template<typename _Tp>
 void ImageHelpers::complexDFT(Mat_<complex<_Tp> > image,
-		Mat_<Vec<_Tp, 2> >& dst)
+		Mat_<Vec<_Tp, 2> >& dst, Size dftSize)
 {
-    int M = getOptimalDFTSize(image.rows);
-    int N = getOptimalDFTSize(image.cols);
+    int M = dftSize.height;
+    int N = dftSize.width;
+
+    CV_Assert((image.rows <= M) && (image.cols <= N));
 
     Mat_<complex<_Tp> > padded;
 
     copyMakeBorder(image, padded, 0, M - image.rows, 0, N - image.cols,
             BORDER_CONSTANT, Scalar::all(0));
 
-    dft(padded, dst, DFT_COMPLEX_OUTPUT);
+    FFTBackend::getDefault()->dft(padded, dst, DFT_COMPLEX_OUTPUT);
+}
+
+template<typename _Tp, typename _Ip>
+void ImageHelpers::convertChannel(Mat_<_Ip> image, int channel,
+        Mat_<_Tp> dst)
+{
+    typedef typename DataType<_Ip>::channel_type _Cp;
+    int cn = DataType<_Ip>::channels;
+
+    CV_Assert((((Mat)dst).rows == ((Mat)image).rows) &&
+            (((Mat)dst).cols == ((Mat)image).cols) &&
+            (channel >= 0) && (channel < cn));
+
+    if(cn == 1)
+    {
+        ((Mat)image).convertTo(dst, DataType<_Tp>::type);
+        return;
+    }
+
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
+    for(int i=0; i<rows; i++)
+    {
+        const _Cp* src = (const _Cp*)image[i] + channel;
+        _Tp* out = dst[i];
+        for(int j=0; j<cols; j++)
+        {
+            out[j] = saturate_cast<_Tp>(src[j*cn]);
+        }
+    }
 }
 
 template<typename _Tp>
 void ImageHelpers::magnitudeComplexImage(Mat_<Vec<_Tp, 2> > image,
-		Mat_<_Tp>& dst)
+		Mat_<_Tp>& dst, int mode)
 {
-    Mat_<_Tp> real;
-    Mat_<_Tp> imaginary;
-    Mat_<_Tp> planes[] = {real, imaginary};
-    split(image, planes);
-    magnitude(planes[0], planes[1], dst);
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
+
+    dst.create(rows, cols);
+    for(int i=0; i<rows; i++)
+    {
+        const _Tp* row = (const _Tp*)image[i];
+        _Tp* out = dst[i];
+        for(int j=0; j<cols; j++)
+        {
+            out[j] = complexMagnitude(row[2*j], row[2*j + 1], mode);
+        }
+    }
+}
+
+template<typename _Tp>
+inline _Tp ImageHelpers::complexMagnitude(_Tp real, _Tp imag, int mode)
+{
+    if(mode == MAGNITUDE_SQUARED)
+    {
+        return (real*real + imag*imag);
+    }
+    if(mode == MAGNITUDE_APPROXIMATE)
+    {
+        _Tp a = std::abs(real);
+        _Tp b = std::abs(imag);
+        return ((_Tp)MAGNITUDE_ALPHA*std::max(a, b) +
+                (_Tp)MAGNITUDE_BETA*std::min(a, b));
+    }
+    return (std::sqrt(real*real + imag*imag));
+}
+
+template<typename _Tp>
+inline void ImageHelpers::combineMagnitude(_Tp& dst, _Tp magnitude,
+        int combination)
+{
+    if(combination == CHANNELS_SUM)
+    {
+        dst += magnitude;
+    }
+    else if(combination == CHANNELS_MAX)
+    {
+        dst = std::max(dst, magnitude);
+    }
+    else {
+        dst = magnitude;
+    }
 }
 
 template<typename _Tp>
@@ -123,7 +832,8 @@ void ImageHelpers::convolutionComplexFilter(Mat_<_Tp> image,
     cv::mulSpectrums(complexDFTImage, complexDFTFilter, spectrum,
     		DFT_COMPLEX_OUTPUT);
 
-    idft(spectrum, dst, DFT_COMPLEX_OUTPUT + DFT_SCALE);
+    FFTBackend::getDefault()->idft(spectrum, dst,
+            DFT_COMPLEX_OUTPUT + DFT_SCALE);
 }
 
 template<typename _Tp>
@@ -136,27 +846,506 @@ void ImageHelpers::convolutionComplexFilter(
     cv::mulSpectrums(complexDFTImage, complexDFTFilter, spectrum,
             DFT_COMPLEX_OUTPUT);
 
-    idft(spectrum, dst, DFT_COMPLEX_OUTPUT + DFT_SCALE);
+    FFTBackend::getDefault()->idft(spectrum, dst,
+            DFT_COMPLEX_OUTPUT + DFT_SCALE);
+}
+
+template<typename _Tp, typename _Sp>
+void ImageHelpers::convolutionComplexFilter(
+        Mat_<Vec<_Tp, 2> > complexDFTImage,
+        const Vec<_Sp, 2>* complexDFTFilter, Mat_<Vec<_Tp, 2> >& dst)
+{
+    Mat_<Vec<_Tp, 2> > spectrum(((Mat)complexDFTImage).size());
+    multiplyComplexSpectra(complexDFTImage, complexDFTFilter, spectrum);
+
+    FFTBackend::getDefault()->idft(spectrum, dst,
+            DFT_COMPLEX_OUTPUT + DFT_SCALE);
+}
+
+template<typename _Tp, typename _Sp>
+void ImageHelpers::multiplyComplexSpectra(
+        Mat_<Vec<_Tp, 2> > complexDFTImage,
+        const Vec<_Sp, 2>* complexDFTFilter, Mat_<Vec<_Tp, 2> > dst)
+{
+    int rows = ((Mat)complexDFTImage).rows;
+    int cols = ((Mat)complexDFTImage).cols;
+
+    CV_Assert(((Mat)dst).size() == ((Mat)complexDFTImage).size());
+
+    for(int i=0; i<rows; i++)
+    {
+        multiplyComplexRow((const _Tp*)complexDFTImage[i],
+                (const _Sp*)(complexDFTFilter + i*cols), (_Tp*)dst[i], cols);
+    }
+}
+
+template<typename _Tp, typename _Sp>
+void ImageHelpers::multiplyComplexSpectra(
+        Mat_<Vec<_Tp, 2> > complexDFTImage,
+        const Vec<_Sp, 2>* const* complexDFTFilters, int count,
+        Mat_<Vec<_Tp, 2> > dst)
+{
+    int rows = ((Mat)complexDFTImage).rows;
+    int cols = ((Mat)complexDFTImage).cols;
+
+    CV_Assert((((Mat)dst).rows == count*rows) &&
+            (((Mat)dst).cols == cols));
+
+    // Whole rows per block when they fit, pieces of a row otherwise
+    int elemSize = (int)sizeof(Vec<_Tp, 2>);
+    int blockCols = std::min(cols, std::max(1, SPECTRUM_BLOCK_SIZE/elemSize));
+    int blockRows = std::max(1, SPECTRUM_BLOCK_SIZE/(blockCols*elemSize));
+
+    for(int firstRow=0; firstRow<rows; firstRow+=blockRows)
+    {
+        int lastRow = std::min(rows, firstRow + blockRows);
+        for(int firstCol=0; firstCol<cols; firstCol+=blockCols)
+        {
+            int n = std::min(blockCols, cols - firstCol);
+            for(int k=0; k<count; k++)
+            {
+                const Vec<_Sp, 2>* filter = complexDFTFilters[k] + firstCol;
+                for(int i=firstRow; i<lastRow; i++)
+                {
+                    multiplyComplexRow(
+                            (const _Tp*)(complexDFTImage[i] + firstCol),
+                            (const _Sp*)(filter + i*cols),
+                            (_Tp*)(dst[k*rows + i] + firstCol), n);
+                }
+            }
+        }
+    }
+}
+
+template<typename _Tp, typename _Sp>
+inline void ImageHelpers::multiplyComplexRow(const _Tp* image,
+        const _Sp* filter, _Tp* product, int n)
+{
+    for(int j=0; j<2*n; j+=2)
+    {
+        _Tp real = image[j]*filter[j] - image[j + 1]*filter[j + 1];
+        _Tp imag = image[j]*filter[j + 1] + image[j + 1]*filter[j];
+        product[j] = real;
+        product[j + 1] = imag;
+    }
+}
+
+/*
+ * With a = (ar, ai) and b = (br, bi) interleaved, the product is
+ * addsub(a*(br, br), (ai, ar)*(bi, bi)): the first term minus the second
+ * one for real parts, plus it for imaginary ones.
+ */
+template<>
+inline void ImageHelpers::multiplyComplexRow<double, double>(
+        const double* image, const double* filter, double* product, int n)
+{
+    int j = 0;
+#if defined(__AVX512F__)
+    for(; j + 4 <= n; j += 4)
+    {
+        __m512d a = _mm512_loadu_pd(image + 2*j);
+        __m512d b = _mm512_loadu_pd(filter + 2*j);
+        __m512d cross = _mm512_mul_pd(_mm512_permute_pd(a, 0x55),
+                _mm512_permute_pd(b, 0xFF));
+        _mm512_storeu_pd(product + 2*j,
+                _mm512_fmaddsub_pd(a, _mm512_movedup_pd(b), cross));
+    }
+#elif defined(__AVX__)
+    for(; j + 2 <= n; j += 2)
+    {
+        __m256d a = _mm256_loadu_pd(image + 2*j);
+        __m256d b = _mm256_loadu_pd(filter + 2*j);
+        __m256d cross = _mm256_mul_pd(_mm256_permute_pd(a, 0x5),
+                _mm256_permute_pd(b, 0xF));
+#if defined(__FMA__)
+        _mm256_storeu_pd(product + 2*j,
+                _mm256_fmaddsub_pd(a, _mm256_movedup_pd(b), cross));
+#else
+        _mm256_storeu_pd(product + 2*j, _mm256_addsub_pd(
+                _mm256_mul_pd(a, _mm256_movedup_pd(b)), cross));
+#endif
+    }
+#elif defined(__SSE3__)
+    for(; j < n; j++)
+    {
+        __m128d a = _mm_loadu_pd(image + 2*j);
+        __m128d b = _mm_loadu_pd(filter + 2*j);
+        __m128d cross = _mm_mul_pd(_mm_shuffle_pd(a, a, 1),
+                _mm_unpackhi_pd(b, b));
+        _mm_storeu_pd(product + 2*j, _mm_addsub_pd(
+                _mm_mul_pd(a, _mm_movedup_pd(b)), cross));
+    }
+#endif
+    for(; j < n; j++)
+    {
+        double real = image[2*j]*filter[2*j] - image[2*j + 1]*filter[2*j + 1];
+        double imag = image[2*j]*filter[2*j + 1] + image[2*j + 1]*filter[2*j];
+        product[2*j] = real;
+        product[2*j + 1] = imag;
+    }
+}
+
+template<>
+inline void ImageHelpers::multiplyComplexRow<float, float>(
+        const float* image, const float* filter, float* product, int n)
+{
+    int j = 0;
+#if defined(__AVX512F__)
+    for(; j + 8 <= n; j += 8)
+    {
+        __m512 a = _mm512_loadu_ps(image + 2*j);
+        __m512 b = _mm512_loadu_ps(filter + 2*j);
+        __m512 cross = _mm512_mul_ps(_mm512_permute_ps(a, 0xB1),
+                _mm512_movehdup_ps(b));
+        _mm512_storeu_ps(product + 2*j,
+                _mm512_fmaddsub_ps(a, _mm512_moveldup_ps(b), cross));
+    }
+#elif defined(__AVX__)
+    for(; j + 4 <= n; j += 4)
+    {
+        __m256 a = _mm256_loadu_ps(image + 2*j);
+        __m256 b = _mm256_loadu_ps(filter + 2*j);
+        __m256 cross = _mm256_mul_ps(_mm256_permute_ps(a, 0xB1),
+                _mm256_movehdup_ps(b));
+#if defined(__FMA__)
+        _mm256_storeu_ps(product + 2*j,
+                _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(b), cross));
+#else
+        _mm256_storeu_ps(product + 2*j, _mm256_addsub_ps(
+                _mm256_mul_ps(a, _mm256_moveldup_ps(b)), cross));
+#endif
+    }
+#elif defined(__SSE3__)
+    for(; j + 2 <= n; j += 2)
+    {
+        __m128 a = _mm_loadu_ps(image + 2*j);
+        __m128 b = _mm_loadu_ps(filter + 2*j);
+        __m128 cross = _mm_mul_ps(_mm_shuffle_ps(a, a,
+                _MM_SHUFFLE(2, 3, 0, 1)), _mm_movehdup_ps(b));
+        _mm_storeu_ps(product + 2*j, _mm_addsub_ps(
+                _mm_mul_ps(a, _mm_moveldup_ps(b)), cross));
+    }
+#endif
+    for(; j < n; j++)
+    {
+        float real = image[2*j]*filter[2*j] - image[2*j + 1]*filter[2*j + 1];
+        float imag = image[2*j]*filter[2*j + 1] + image[2*j + 1]*filter[2*j];
+        product[2*j] = real;
+        product[2*j + 1] = imag;
+    }
 }
 
 template<typename _Tp>
-void ImageHelpers::downSample(Mat_<Vec<_Tp, 2> >image,
-		Mat_<Vec<_Tp, 2> >& dst, double ratio, int method)
+void ImageHelpers::foldSpectrum(Mat_<Vec<_Tp, 2> > spectrum,
+        Mat_<Vec<_Tp, 2> > dst, int step)
+{
+    int rows = ((Mat)dst).rows;
+    int cols = ((Mat)dst).cols;
+
+    CV_Assert((((Mat)spectrum).rows == rows*step) &&
+            (((Mat)spectrum).cols == cols*step));
+
+    // Keeps the scale of the full size inverse DFT
+    _Tp scale = _Tp(1) / (step*step);
+
+    for(int i=0; i<rows; i++)
+    {
+        Vec<_Tp, 2>* row = dst[i];
+        for(int j=0; j<cols; j++)
+        {
+            row[j] = Vec<_Tp, 2>();
+        }
+        for(int a=0; a<step; a++)
+        {
+            const Vec<_Tp, 2>* src = spectrum[i + a*rows];
+            for(int b=0; b<step; b++)
+            {
+                const Vec<_Tp, 2>* block = src + b*cols;
+                for(int j=0; j<cols; j++)
+                {
+                    row[j][0] += block[j][0];
+                    row[j][1] += block[j][1];
+                }
+            }
+        }
+        for(int j=0; j<cols; j++)
+        {
+            row[j][0] *= scale;
+            row[j][1] *= scale;
+        }
+    }
+}
+
+template<typename _Tp>
+void ImageHelpers::cropSpectrum(Mat_<Vec<_Tp, 2> > spectrum,
+        Mat_<Vec<_Tp, 2> > dst, int step)
+{
+    int rows = ((Mat)dst).rows;
+    int cols = ((Mat)dst).cols;
+    int fullRows = ((Mat)spectrum).rows;
+    int fullCols = ((Mat)spectrum).cols;
+
+    CV_Assert((fullRows == rows*step) && (fullCols == cols*step));
+
+    _Tp scale = _Tp(1) / (step*step);
+
+    // Non negative frequencies come from the start of each axis, negative
+    // ones from its end
+    for(int i=0; i<rows; i++)
+    {
+        const Vec<_Tp, 2>* src = spectrum[(i < (rows + 1)/2) ? i :
+                i + fullRows - rows];
+        Vec<_Tp, 2>* row = dst[i];
+        for(int j=0; j<cols; j++)
+        {
+            const Vec<_Tp, 2>& value =
+                    src[(j < (cols + 1)/2) ? j : j + fullCols - cols];
+            row[j][0] = value[0]*scale;
+            row[j][1] = value[1]*scale;
+        }
+    }
+}
+
+template<typename _Tp>
+void ImageHelpers::convolutionRealFilter(Mat_<_Tp> realDFTImage,
+        const _Tp* realDFTFilter, Mat_<Vec<_Tp, 2> >& dst)
+{
+    int rows = ((Mat)realDFTImage).rows;
+    int cols = ((Mat)realDFTImage).cols;
+
+    Mat_<_Tp> filter(rows, cols, (_Tp*)realDFTFilter);
+    Mat_<_Tp> spectrum;
+    mulSpectrums(realDFTImage, filter, spectrum, 0);
+
+    Mat_<_Tp> response;
+    FFTBackend::getDefault()->idft(spectrum, response,
+            DFT_REAL_OUTPUT + DFT_SCALE);
+
+    Mat_<_Tp> planes[] = {response, Mat_<_Tp>::zeros(rows, cols)};
+    merge(planes, 2, dst);
+}
+
+template<typename _Tp>
+void ImageHelpers::separableDecomposition(Mat_<complex<_Tp> > kernel,
+        SeparableKernel<_Tp>& dst, double tolerance, int offsetX,
+        int offsetY)
+{
+    Mat_<complex<_Tp> > flipped;
+    flip(kernel, flipped, -1);
+
+    Mat_<_Tp> real;
+    Mat_<_Tp> imaginary;
+    Mat_<_Tp> planes[] = {real, imaginary};
+    split(flipped, planes);
+
+    dst.sizeX = ((Mat)kernel).rows;
+    dst.sizeY = ((Mat)kernel).cols;
+    dst.offsetX = offsetX;
+    dst.offsetY = offsetY;
+
+    vector<Mat_<_Tp> >* columns[] = {&dst.realColumns, &dst.imagColumns};
+    vector<Mat_<_Tp> >* rows[] = {&dst.realRows, &dst.imagRows};
+
+    SVD svd[2];
+    double energy = 0;
+    for(int part=0; part<2; part++)
+    {
+        svd[part] = SVD(planes[part]);
+        Mat_<double> w = svd[part].w;
+        energy += w.dot(w);
+    }
+
+    for(int part=0; part<2; part++)
+    {
+        Mat_<double> w = svd[part].w;
+        Mat_<_Tp> u = svd[part].u;
+        Mat_<_Tp> vt = svd[part].vt;
+
+        // Energy left out by the terms not taken yet
+        double residual = w.dot(w);
+
+        columns[part]->clear();
+        rows[part]->clear();
+
+        for(int i=0; (i<w.rows) &&
+                (residual > tolerance*tolerance*energy); i++)
+        {
+            _Tp weight = sqrt(w(i,0));
+            columns[part]->push_back(Mat_<_Tp>(u.col(i) * weight));
+            rows[part]->push_back(Mat_<_Tp>(vt.row(i) * weight));
+            residual -= w(i,0) * w(i,0);
+        }
+    }
+}
+
+template<typename _Tp>
+void ImageHelpers::convolutionSeparable(Mat_<_Tp> image,
+        const SeparableKernel<_Tp>& kernel, Mat_<Vec<_Tp, 2> >& dst,
+        Mat_<_Tp> term)
 {
-	Mat_<_Tp> real;
-	Mat_<_Tp> imaginary;
-	Mat_<_Tp> planes[] = {real, imaginary};
-	split(image, planes);
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
 
-	Mat_<_Tp> realResized;
-	Mat_<_Tp> imaginaryResized;
+    // Correlating with the flipped terms anchored at their last element
+    // gives the convolution with the kernel anchored at its first one.
+    // Kernels placed before the image move the anchor back instead, and
+    // positive offsets move the response afterwards.
+    CV_Assert((kernel.offsetX > -kernel.sizeX) &&
+            (kernel.offsetY > -kernel.sizeY));
+    Point anchor(kernel.sizeY - 1 + min(kernel.offsetY, 0),
+            kernel.sizeX - 1 + min(kernel.offsetX, 0));
+    int shiftX = max(kernel.offsetX, 0);
+    int shiftY = max(kernel.offsetY, 0);
 
-	resize(planes[0], realResized, Size(), ratio, ratio, method);
-	resize(planes[1], imaginaryResized, Size(), ratio, ratio, method);
+    dst.create(rows, cols);
+    ((Mat)dst).setTo(Scalar::all(0));
 
-	Mat_<_Tp> planesResized[] = {realResized, imaginaryResized};
+    const vector<Mat_<_Tp> >* columns[] = {&kernel.realColumns,
+            &kernel.imagColumns};
+    const vector<Mat_<_Tp> >* rowTerms[] = {&kernel.realRows,
+            &kernel.imagRows};
 
-	merge(planesResized, 2, dst);
+    // Each term is added into its part of the response, moved as the kernel
+    // offset moves the kernel
+    int validRows = rows - shiftX;
+    int validCols = cols - shiftY;
+    for(int part=0; part<2; part++)
+    {
+        for(size_t i=0; i<columns[part]->size(); i++)
+        {
+            sepFilter2D(image, term, DataType<_Tp>::depth,
+                    (*rowTerms[part])[i], (*columns[part])[i], anchor, 0,
+                    BORDER_CONSTANT);
+            for(int r=0; r<validRows; r++)
+            {
+                const _Tp* src = term[r];
+                Vec<_Tp, 2>* row = dst[r + shiftX] + shiftY;
+                for(int c=0; c<validCols; c++)
+                {
+                    row[c][part] += src[c];
+                }
+            }
+        }
+    }
+}
+
+inline void ImageHelpers::recursiveGaussianCoefficients(double sigma,
+        double* coefficients)
+{
+    CV_Assert(sigma >= 0.5);
+
+    double q;
+    if(sigma >= 2.5)
+    {
+        q = 0.98711*sigma - 0.96330;
+    }
+    else {
+        q = 3.97156 - 4.14554*sqrt(1 - 0.26891*sigma);
+    }
+
+    double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+    double b1 = 2.44413*q + 2.85619*q*q + 1.26661*q*q*q;
+    double b2 = -(1.4281*q*q + 1.26661*q*q*q);
+    double b3 = 0.422205*q*q*q;
+
+    coefficients[0] = 1 - (b1 + b2 + b3)/b0;
+    coefficients[1] = b1/b0;
+    coefficients[2] = b2/b0;
+    coefficients[3] = b3/b0;
+}
+
+template<typename _Tp>
+void ImageHelpers::recursiveGaussian(Mat image, const double* coefficients)
+{
+    CV_Assert(image.depth() == DataType<_Tp>::depth);
+
+    RecursiveGaussianBody<_Tp> horizontalBody(image, coefficients, false);
+    parallel_for(BlockedRange(0, image.rows), horizontalBody);
+
+    RecursiveGaussianBody<_Tp> verticalBody(image, coefficients, true);
+    parallel_for(BlockedRange(0, image.cols * image.channels()),
+            verticalBody);
+}
+
+inline Size ImageHelpers::getRecursivePaddedSize(Size imageSize,
+        const RecursiveGaborKernel& kernel)
+{
+    // The backward passes start from rest, so the forward response needs
+    // room to decay past the bottom and right borders.
+    int tail = cvCeil(3*kernel.sigma);
+
+    return (Size(imageSize.width + kernel.offsetY + tail,
+            imageSize.height + kernel.offsetX + tail));
+}
+
+template<typename _Tp>
+void ImageHelpers::convolutionRecursiveGabor(Mat_<_Tp> image,
+        const RecursiveGaborKernel& kernel, Mat_<Vec<_Tp, 2> >& dst,
+        Mat_<_Tp> padded, Mat_<Vec<_Tp, 2> > demodulated)
+{
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
+
+    Size paddedSize = getRecursivePaddedSize(((Mat)image).size(), kernel);
+    copyMakeBorder(image, padded, kernel.offsetX,
+            paddedSize.height - rows - kernel.offsetX, kernel.offsetY,
+            paddedSize.width - cols - kernel.offsetY, BORDER_CONSTANT,
+            Scalar::all(0));
+
+    int paddedRows = ((Mat)padded).rows;
+    int paddedCols = ((Mat)padded).cols;
+
+    vector<complex<double> > rowCarrier(paddedRows);
+    vector<complex<double> > colCarrier(paddedCols);
+    for(int i=0; i<paddedRows; i++)
+    {
+        rowCarrier[i] = polar(1.0, kernel.omegaX*i);
+    }
+    for(int j=0; j<paddedCols; j++)
+    {
+        colCarrier[j] = polar(1.0, kernel.omegaY*j);
+    }
+
+    demodulated.create(paddedRows, paddedCols);
+    complex<double> value;
+    for(int i=0; i<paddedRows; i++)
+    {
+        const _Tp* src = padded[i];
+        Vec<_Tp, 2>* row = demodulated[i];
+        for(int j=0; j<paddedCols; j++)
+        {
+            value = conj(rowCarrier[i]*colCarrier[j]) * (double)src[j];
+            row[j] = Vec<_Tp, 2>(value.real(), value.imag());
+        }
+    }
+
+    recursiveGaussian<_Tp>(demodulated, kernel.coefficients);
+    // Low-pass response for the DC compensation term
+    recursiveGaussian<_Tp>(padded, kernel.coefficients);
+
+    dst.create(rows, cols);
+    for(int i=0; i<rows; i++)
+    {
+        const Vec<_Tp, 2>* src = demodulated[i];
+        const _Tp* lowPass = padded[i];
+        Vec<_Tp, 2>* row = dst[i];
+        for(int j=0; j<cols; j++)
+        {
+            value = rowCarrier[i]*colCarrier[j] *
+                    complex<double>(src[j][0], src[j][1]) -
+                    kernel.dcTerm*lowPass[j];
+            value *= kernel.gain;
+            row[j] = Vec<_Tp, 2>(value.real(), value.imag());
+        }
+    }
+}
+
+template<typename _Tp>
+void ImageHelpers::downSample(Mat_<Vec<_Tp, 2> >image,
+		Mat_<Vec<_Tp, 2> >& dst, double ratio, int method)
+{
+	// Both parts are resized at once, straight into dst
+	resize(image, dst, Size(), ratio, ratio, method);
 }
 
 template<typename _Tp>
@@ -191,6 +1380,152 @@ void ImageHelpers::zmuNormalization(Mat_<Vec<_Tp, 2> > image,
     merge(planes2, 2, dst);
 }
 
+template<typename _Tp>
+void ImageHelpers::zmuMagnitude(Mat_<Vec<_Tp, 2> > image, _Tp* dst,
+        bool needZMUNorm, int combination, int mode, int pooling,
+        int poolingStep)
+{
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
+
+    if(!needZMUNorm)
+    {
+        zmuMagnitude(image, dst, Vec<_Tp, 2>(0, 0), _Tp(1), combination,
+                mode, pooling, poolingStep);
+        return;
+    }
+
+    // Sums kept in double, the sum of squares would lose the variance of
+    // float responses otherwise
+    double sumReal = 0;
+    double sumImag = 0;
+    double sumSquares = 0;
+    for(int i=0; i<rows; i++)
+    {
+        const _Tp* row = (const _Tp*)image[i];
+        for(int j=0; j<2*cols; j+=2)
+        {
+            sumReal += row[j];
+            sumImag += row[j + 1];
+            sumSquares += (double)row[j]*row[j] + (double)row[j + 1]*row[j + 1];
+        }
+    }
+
+    double elems = (double)rows*cols;
+    double meanReal = sumReal / elems;
+    double meanImag = sumImag / elems;
+    // Same unbiased estimate as MathHelpers::stdMean, for both parts at once
+    double variance = (sumSquares - elems*(meanReal*meanReal +
+            meanImag*meanImag)) / (elems - 1);
+
+    zmuMagnitude(image, dst, Vec<_Tp, 2>((_Tp)meanReal, (_Tp)meanImag),
+            (_Tp)sqrt(std::max(variance, 0.0)), combination, mode, pooling,
+            poolingStep);
+}
+
+template<typename _Tp>
+void ImageHelpers::zmuMagnitude(Mat_<Vec<_Tp, 2> > image, _Tp* dst,
+        Vec<_Tp, 2> mean, _Tp std, int combination, int mode, int pooling,
+        int poolingStep)
+{
+    int rows = ((Mat)image).rows;
+    int cols = ((Mat)image).cols;
+
+    _Tp meanReal = mean[0];
+    _Tp meanImag = mean[1];
+    _Tp scale = _Tp(1) / std;
+
+    if(pooling == POOLING_NONE)
+    {
+        for(int i=0; i<rows; i++)
+        {
+            const _Tp* row = (const _Tp*)image[i];
+            _Tp* out = dst + i*cols;
+            for(int j=0; j<cols; j++)
+            {
+                _Tp real = (row[2*j] - meanReal) * scale;
+                _Tp imag = (row[2*j + 1] - meanImag) * scale;
+                combineMagnitude(out[j], complexMagnitude(real, imag, mode),
+                        combination);
+            }
+        }
+        return;
+    }
+
+    CV_Assert(poolingStep > 0);
+
+    // Magnitudes are never negative, so 0 starts both the sum and the max
+    int pooledRows = getPooledSize(rows, poolingStep);
+    int pooledCols = getPooledSize(cols, poolingStep);
+    for(int o=0; o<pooledRows; o++)
+    {
+        int firstRow = o*poolingStep;
+        int lastRow = std::min(firstRow + poolingStep, rows);
+        _Tp* out = dst + o*pooledCols;
+        for(int q=0; q<pooledCols; q++)
+        {
+            int firstCol = q*poolingStep;
+            int lastCol = std::min(firstCol + poolingStep, cols);
+            _Tp pooled = 0;
+            for(int i=firstRow; i<lastRow; i++)
+            {
+                const _Tp* row = (const _Tp*)image[i];
+                for(int j=firstCol; j<lastCol; j++)
+                {
+                    _Tp real = (row[2*j] - meanReal) * scale;
+                    _Tp imag = (row[2*j + 1] - meanImag) * scale;
+                    _Tp magnitude = complexMagnitude(real, imag, mode);
+                    if(pooling == POOLING_MAX)
+                    {
+                        pooled = std::max(pooled, magnitude);
+                    }
+                    else {
+                        pooled += magnitude;
+                    }
+                }
+            }
+            if(pooling == POOLING_AVERAGE)
+            {
+                pooled /= (_Tp)((lastRow - firstRow)*(lastCol - firstCol));
+            }
+            combineMagnitude(out[q], pooled, combination);
+        }
+    }
+}
+
+inline int ImageHelpers::getPooledSize(int n, int step)
+{
+    return (cvRound((double)n/step));
+}
+
+template<typename _Tp>
+void ImageHelpers::spectrumStdMean(Mat_<Vec<_Tp, 2> > spectrum,
+        Vec<_Tp, 2>& mean, _Tp& std)
+{
+    int rows = ((Mat)spectrum).rows;
+    int cols = ((Mat)spectrum).cols;
+
+    double energy = 0;
+    for(int i=0; i<rows; i++)
+    {
+        const _Tp* row = (const _Tp*)spectrum[i];
+        for(int j=0; j<2*cols; j++)
+        {
+            energy += (double)row[j]*row[j];
+        }
+    }
+
+    // With x = idft(X)/N: mean(x) = X(0)/N and sum |x|^2 = sum |X|^2 / N
+    double elems = (double)rows*cols;
+    double dcReal = spectrum(0, 0)[0];
+    double dcImag = spectrum(0, 0)[1];
+    double variance = (energy - (dcReal*dcReal + dcImag*dcImag)) /
+            (elems*(elems - 1));
+
+    mean = Vec<_Tp, 2>((_Tp)(dcReal / elems), (_Tp)(dcImag / elems));
+    std = (_Tp)sqrt(std::max(variance, 0.0));
+}
+
 }
 
 #endif /* IMAHEHELPERS_HPP_ */
@@ -0,0 +1,185 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef KERNELBANK_HPP_
+#define KERNELBANK_HPP_
+
+// TODO: Check really needed header files, including all OpenCV headers
+// is way too much
+#include "opencv2/opencv.hpp"
+#include "FilterBank.hpp"
+#include <vector>
+
+namespace fex
+{
+
+using namespace cv;
+
+/*
+ * Filter bank made of user supplied spatial kernels (log-Gabor, DoG, learned
+ * kernels...), so that they get the same filtering plans and extraction
+ * pipeline as Gabor sets.
+ *
+ * Kernels may have different sizes, the nominal frame is the smallest one
+ * holding all of them. Kernels without imaginary part are applied through
+ * half spectra. They are not copied, so they must not be modified
+ * once added.
+ */
+template<typename _Tp> class KernelBank : public FilterBank<_Tp>
+{
+public:
+	/*
+	 * Typedefs
+	 */
+	typedef _Tp value_type;
+
+	/*
+	 * Constructors
+	 */
+	KernelBank();
+	KernelBank(const vector<Mat_<complex<_Tp> > >& kernels);
+	virtual ~KernelBank();
+
+	/*
+	 * Methods
+	 */
+	void add(const Mat_<complex<_Tp> >& kernel);
+	void add(const Mat_<_Tp>& kernel);
+
+	/*
+	 * FilterBank interface
+	 */
+	int getNumFilters() const;
+	int getFilterSizeX() const;
+	int getFilterSizeY() const;
+	Mat_<complex<_Tp> > getKernel(int index) const;
+	bool isRealKernel(int index) const;
+	FilterBank<_Tp>* clone() const;
+
+private:
+	/*
+	 * Attributes
+	 */
+	vector<Mat_<complex<_Tp> > > mKernels;
+	vector<uchar> mRealKernels;
+	int mFilterSizeX;
+	int mFilterSizeY;
+};
+
+/******************************************************************************
+ ******************************************************************************
+ **                          CLASS IMPLEMENTATION                            **
+ ******************************************************************************
+ ******************************************************************************/
+
+/**************
+ * Constructors
+ **************/
+template<typename _Tp> KernelBank<_Tp>::KernelBank() : mFilterSizeX(0),
+		mFilterSizeY(0)
+{
+}
+
+template<typename _Tp> KernelBank<_Tp>::KernelBank(
+		const vector<Mat_<complex<_Tp> > >& kernels) : mFilterSizeX(0),
+		mFilterSizeY(0)
+{
+	for(size_t i=0; i<kernels.size(); i++)
+	{
+		add(kernels[i]);
+	}
+}
+
+template<typename _Tp> KernelBank<_Tp>::~KernelBank()
+{
+}
+
+/*********
+ * Methods
+ *********/
+template<typename _Tp>
+void KernelBank<_Tp>::add(const Mat_<complex<_Tp> >& kernel)
+{
+	CV_Assert(!kernel.empty());
+
+	Mat_<_Tp> planes[2];
+	split(kernel, planes);
+
+	mKernels.push_back(kernel);
+	mRealKernels.push_back(countNonZero(planes[1]) == 0);
+	mFilterSizeX = max(mFilterSizeX, kernel.rows);
+	mFilterSizeY = max(mFilterSizeY, kernel.cols);
+}
+
+template<typename _Tp>
+void KernelBank<_Tp>::add(const Mat_<_Tp>& kernel)
+{
+	Mat_<_Tp> imaginary = Mat_<_Tp>::zeros(kernel.rows, kernel.cols);
+	Mat_<_Tp> planes[] = {kernel, imaginary};
+	Mat_<complex<_Tp> > complexKernel;
+	merge(planes, 2, complexKernel);
+
+	add(complexKernel);
+}
+
+/*********************
+ * FilterBank interface
+ *********************/
+template<typename _Tp>
+inline int KernelBank<_Tp>::getNumFilters() const
+{
+	return (mKernels.size());
+}
+
+template<typename _Tp>
+inline int KernelBank<_Tp>::getFilterSizeX() const
+{
+	return (mFilterSizeX);
+}
+
+template<typename _Tp>
+inline int KernelBank<_Tp>::getFilterSizeY() const
+{
+	return (mFilterSizeY);
+}
+
+template<typename _Tp>
+inline Mat_<complex<_Tp> > KernelBank<_Tp>::getKernel(int index) const
+{
+	return (mKernels[index]);
+}
+
+template<typename _Tp>
+inline bool KernelBank<_Tp>::isRealKernel(int index) const
+{
+	return (mRealKernels[index] != 0);
+}
+
+template<typename _Tp>
+FilterBank<_Tp>* KernelBank<_Tp>::clone() const
+{
+	return (new KernelBank<_Tp>(*this));
+}
+
+}
+
+#endif /* KERNELBANK_HPP_ */
@@ -140,7 +140,7 @@ bool LDAQR<_Tp>::train(Mat_<_Tp> trainingSet, Mat_<int> classes)
 
     SVD s(this->R,SVD::NO_UV);
 
-    Mat_<double> S(s.w);
+    Mat_<_Tp> S(s.w);
 
     Mat_<_Tp> SLog;
     log(S,SLog);
@@ -0,0 +1,69 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *  
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *   
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *   
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#include "MappedFile.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fex
+{
+using namespace cv;
+
+MappedFile::MappedFile(const string& filename) : mData(0), mSize(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        CV_Error(CV_StsError, "Could not open " + filename);
+    }
+
+    struct stat status;
+    if((fstat(fd, &status) != 0) || (status.st_size <= 0))
+    {
+        close(fd);
+        CV_Error(CV_StsError, "Could not get the size of " + filename);
+    }
+
+    void* data = mmap(0, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        CV_Error(CV_StsError, "Could not map " + filename);
+    }
+
+    mData = static_cast<uchar*>(data);
+    mSize = status.st_size;
+}
+
+MappedFile::~MappedFile()
+{
+    if(mData)
+    {
+        munmap(mData, mSize);
+    }
+}
+
+}
@@ -0,0 +1,78 @@
+/***************************************************************************
+ *  Copyright (c) 2011 Javier Moro Sotelo.
+ *
+ *  This file is part of libfex.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Contributors:
+ *      Javier Moro Sotelo - initial API and implementation
+ ***************************************************************************/
+
+#ifndef MAPPEDFILE_HPP_
+#define MAPPEDFILE_HPP_
+
+#include "opencv2/opencv.hpp"
+#include <string>
+
+namespace fex
+{
+
+using namespace cv;
+using namespace std;
+
+/*
+ * Read-only memory mapping of a whole file.
+ *
+ * The mapping is shared with every other process mapping the same file, and
+ * is released when the object is destroyed. Hold it through a Ptr to share
+ * it between the objects pointing into it.
+ */
+class MappedFile
+{
+public:
+
+    MappedFile(const string& filename);
+    virtual ~MappedFile();
+
+    const uchar* getData() const;
+    size_t getSize() const;
+
+private:
+    /*
+     * Attributes
+     */
+    uchar* mData;
+    size_t mSize;
+
+    /*
+     * Copies are not allowed, the mapping has a single owner
+     */
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+inline const uchar* MappedFile::getData() const
+{
+    return (mData);
+}
+
+inline size_t MappedFile::getSize() const
+{
+    return (mSize);
+}
+
+}
+
+#endif /* MAPPEDFILE_HPP_ */
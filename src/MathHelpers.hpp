@@ -112,9 +112,10 @@ void MathHelpers::QR(const Mat_<_Tp>& A, Mat_<_Tp>& Q, Mat_<_Tp>& R,
     int cols = (Mat(A)).cols;
     Mat_<_Tp> At = A.t();
 
-    arma::mat AArma(((cv::Mat)At).ptr<_Tp>(0), rows, cols, false);
+    // Armadillo works in the element type, float matrices stay in float
+    arma::Mat<_Tp> AArma(((cv::Mat)At).ptr<_Tp>(0), rows, cols, false);
 
-    arma::mat QArma, RArma;
+    arma::Mat<_Tp> QArma, RArma;
 
     arma::qr(QArma, RArma, AArma);
     Q = Mat_<_Tp>(QArma.n_cols, QArma.n_rows, QArma.memptr()).t();
@@ -151,6 +152,8 @@ void MathHelpers::stdMean(const Mat_<_Tp> mat, _Tp& std, _Tp& mean)
 
     _Tp* data = ((Mat)mat).ptr<_Tp>(0);
 
+    mean = 0;
+    std = 0;
     for(int index=0; index<elems; index++)
     {
         mean += *data++;